@@ -0,0 +1,259 @@
+/*---------------------------------------------------------------------------*/
+/*intern.c*/
+/*---------------------------------------------------------------------------*/
+/*The table of interned names shared by all lnodes.*/
+/*---------------------------------------------------------------------------*/
+/*Copyright (C) 2009 Free Software Foundation, Inc.
+
+  This program is free software; you can redistribute it and/or
+  modify it under the terms of the GNU General Public License as
+  published by the Free Software Foundation; either version 2 of the
+  License, or * (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+  General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307
+  USA.*/
+/*---------------------------------------------------------------------------*/
+
+/*---------------------------------------------------------------------------*/
+#define _GNU_SOURCE 1
+/*---------------------------------------------------------------------------*/
+#include <stdlib.h>
+#include <string.h>
+/*---------------------------------------------------------------------------*/
+#include "intern.h"
+/*---------------------------------------------------------------------------*/
+
+/*---------------------------------------------------------------------------*/
+/*--------Macros-------------------------------------------------------------*/
+/*Selects the stripe responsible for the names with `hash`; the bits
+  used here are not the ones selecting the bucket in small stripes*/
+#define INTERN_STRIPE(hash)\
+	(&intern_stripes[((hash) >> 16) & (INTERN_STRIPES - 1)])
+/*---------------------------------------------------------------------------*/
+
+/*---------------------------------------------------------------------------*/
+/*--------Types--------------------------------------------------------------*/
+/*An independently locked part of the table of names*/
+struct intern_stripe
+{
+  /*the lock protecting this stripe */
+  struct mutex lock;
+
+  /*the buckets; `size` is always a power of two */
+  intern_name_t **buckets;
+  size_t size;
+
+  /*the number of names in this stripe */
+  size_t count;
+};				/*struct intern_stripe */
+/*---------------------------------------------------------------------------*/
+typedef struct intern_stripe intern_stripe_t;
+/*---------------------------------------------------------------------------*/
+
+/*---------------------------------------------------------------------------*/
+/*--------Global Variables---------------------------------------------------*/
+/*The stripes of the table*/
+static intern_stripe_t intern_stripes[INTERN_STRIPES] =
+  {[0 ... INTERN_STRIPES - 1] = {MUTEX_INITIALIZER}};
+/*---------------------------------------------------------------------------*/
+/*The number of names in the table and the memory occupied by them*/
+static volatile unsigned long intern_names;
+static volatile unsigned long intern_bytes;
+/*---------------------------------------------------------------------------*/
+/*The number of references to all names, i.e. the number of copies
+  of names which would have been allocated without interning*/
+static volatile unsigned long intern_references;
+/*---------------------------------------------------------------------------*/
+
+/*---------------------------------------------------------------------------*/
+/*--------Functions----------------------------------------------------------*/
+/*Computes the hash of the first `len` characters of `str`*/
+unsigned long intern_hash (const char * str, size_t len)
+{
+  /*The hash being computed (FNV-1a) */
+  unsigned long hash = 2166136261UL;
+
+  /*Mix in every character of the string */
+  for (; len; --len, ++str)
+    {
+      hash ^= (unsigned char) *str;
+      hash *= 16777619UL;
+    }
+
+  return hash;
+}				/*intern_hash */
+
+/*---------------------------------------------------------------------------*/
+/*Finds `str` of length `len` and hash `hash` in `stripe`, which must
+  be locked*/
+static intern_name_t *intern_stripe_find
+  (intern_stripe_t * stripe, const char * str, size_t len, unsigned long hash)
+{
+  /*The name being examined */
+  intern_name_t *name = NULL;
+
+  /*Look through the corresponding bucket */
+  if (stripe->buckets)
+    for (name = stripe->buckets[hash & (stripe->size - 1)]; name;
+	 name = name->next)
+      if ((name->hash == hash) && (name->len == len)
+	  && (memcmp (name->str, str, len) == 0))
+	break;
+
+  return name;
+}				/*intern_stripe_find */
+
+/*---------------------------------------------------------------------------*/
+/*Rehashes the names of `stripe` (which must be locked) into `size`
+  buckets*/
+static error_t intern_stripe_resize (intern_stripe_t * stripe, size_t size)
+{
+  /*The new buckets */
+  intern_name_t **buckets = calloc (size, sizeof (intern_name_t *));
+  if (!buckets)
+    return ENOMEM;
+
+  /*The name being moved and the one after it */
+  intern_name_t *name, *next;
+
+  /*The index of the old bucket being emptied */
+  size_t i;
+
+  /*Move every name into its new bucket */
+  for (i = 0; i < stripe->size; ++i)
+    for (name = stripe->buckets[i]; name; name = next)
+      {
+	next = name->next;
+	name->next = buckets[name->hash & (size - 1)];
+	buckets[name->hash & (size - 1)] = name;
+      }
+
+  /*Replace the old buckets */
+  free (stripe->buckets);
+  stripe->buckets = buckets;
+  stripe->size = size;
+
+  return 0;
+}				/*intern_stripe_resize */
+
+/*---------------------------------------------------------------------------*/
+/*Finds the interned copy of the first `len` characters of `str`,
+  creating it if required, and adds a reference to it*/
+error_t intern_get (const char * str, size_t len, intern_name_t ** name)
+{
+  /*The hash of the string and the stripe it belongs to */
+  unsigned long hash = intern_hash (str, len);
+  intern_stripe_t *stripe = INTERN_STRIPE (hash);
+
+  /*The name found or created */
+  intern_name_t *n;
+
+  mutex_lock (&stripe->lock);
+
+  /*If the string is already interned, reference the existing copy */
+  n = intern_stripe_find (stripe, str, len, hash);
+  if (n)
+    {
+      __sync_fetch_and_add (&n->references, 1);
+      mutex_unlock (&stripe->lock);
+
+      __sync_fetch_and_add (&intern_references, 1);
+      *name = n;
+      return 0;
+    }
+
+  /*Make sure the stripe has buckets; grow them if they are getting
+     too long, ignoring the failure, which only slows the lookups */
+  if (!stripe->buckets)
+    {
+      if (intern_stripe_resize (stripe, INTERN_BUCKETS_INIT))
+	{
+	  mutex_unlock (&stripe->lock);
+	  return ENOMEM;
+	}
+    }
+  else if (stripe->count >= stripe->size * INTERN_LOAD_MAX)
+    intern_stripe_resize (stripe, stripe->size * 2);
+
+  /*Create a new copy of the string */
+  n = malloc (sizeof (intern_name_t) + len + 1);
+  if (!n)
+    {
+      mutex_unlock (&stripe->lock);
+      return ENOMEM;
+    }
+  n->references = 1;
+  n->hash = hash;
+  n->len = len;
+  memcpy (n->str, str, len);
+  n->str[len] = 0;
+
+  /*Put the new name into its bucket */
+  n->next = stripe->buckets[hash & (stripe->size - 1)];
+  stripe->buckets[hash & (stripe->size - 1)] = n;
+  ++stripe->count;
+
+  mutex_unlock (&stripe->lock);
+
+  /*Count the new name */
+  __sync_fetch_and_add (&intern_names, 1);
+  __sync_fetch_and_add (&intern_bytes, sizeof (intern_name_t) + len + 1);
+  __sync_fetch_and_add (&intern_references, 1);
+
+  *name = n;
+  return 0;
+}				/*intern_get */
+
+
+/*---------------------------------------------------------------------------*/
+/*Removes a reference from `name`, freeing it if that was the last one*/
+void intern_release (intern_name_t * name)
+{
+  /*The stripe containing `name` */
+  intern_stripe_t *stripe = INTERN_STRIPE (name->hash);
+
+  /*The link pointing to `name` in its bucket */
+  intern_name_t **np;
+
+  __sync_fetch_and_sub (&intern_references, 1);
+
+  /*Drop the reference under the lock of the stripe, so that the name
+     cannot be found and referenced again after it drops to zero */
+  mutex_lock (&stripe->lock);
+  if (__sync_sub_and_fetch (&name->references, 1) > 0)
+    {
+      mutex_unlock (&stripe->lock);
+      return;
+    }
+
+  /*Unlink the name from its bucket */
+  for (np = &stripe->buckets[name->hash & (stripe->size - 1)]; *np != name;
+       np = &(*np)->next);
+  *np = name->next;
+  --stripe->count;
+
+  mutex_unlock (&stripe->lock);
+
+  /*Count the removal of the name */
+  __sync_fetch_and_sub (&intern_names, 1);
+  __sync_fetch_and_sub (&intern_bytes, sizeof (intern_name_t) + name->len + 1);
+
+  free (name);
+}				/*intern_release */
+
+/*---------------------------------------------------------------------------*/
+/*Prints the counters of the table of names to `f`*/
+void intern_report (FILE * f)
+{
+  fprintf (f, "interned names: %lu names, %lu references, %lu bytes\n",
+	   intern_names, intern_references, intern_bytes);
+}				/*intern_report */
+
+/*---------------------------------------------------------------------------*/
@@ -0,0 +1,90 @@
+/*---------------------------------------------------------------------------*/
+/*intern.h*/
+/*---------------------------------------------------------------------------*/
+/*The table of interned names shared by all lnodes. The table only
+  saves memory: lookups in directories compare the hashes, lengths and
+  bytes of names, since finding the interned copy of a name would take
+  a lock the lock-free lookups avoid.*/
+/*---------------------------------------------------------------------------*/
+/*Copyright (C) 2009 Free Software Foundation, Inc.
+
+  This program is free software; you can redistribute it and/or
+  modify it under the terms of the GNU General Public License as
+  published by the Free Software Foundation; either version 2 of the
+  License, or * (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+  General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307
+  USA.*/
+/*---------------------------------------------------------------------------*/
+#ifndef __INTERN_H__
+#define __INTERN_H__
+
+/*---------------------------------------------------------------------------*/
+#include <stdio.h>
+#include <errno.h>
+#include <cthreads.h>
+/*---------------------------------------------------------------------------*/
+
+/*---------------------------------------------------------------------------*/
+/*--------Macros-------------------------------------------------------------*/
+/*The number of independently locked parts of the table (must be a
+  power of two)*/
+#define INTERN_STRIPES 16
+/*---------------------------------------------------------------------------*/
+/*The initial number of buckets in a stripe (must be a power of two)*/
+#define INTERN_BUCKETS_INIT 64
+/*---------------------------------------------------------------------------*/
+/*A stripe is grown when the average number of names per bucket
+  exceeds this value*/
+#define INTERN_LOAD_MAX 2
+/*---------------------------------------------------------------------------*/
+
+/*---------------------------------------------------------------------------*/
+/*--------Types--------------------------------------------------------------*/
+/*An interned name. There is at most one such structure for every
+  string, shared by all lnodes with that name; its hash is kept, so it
+  need not be computed again*/
+struct intern_name
+{
+  /*the next name in the same bucket */
+  struct intern_name *next;
+
+  /*the number of references to this name */
+  volatile int references;
+
+  /*the hash of the string */
+  unsigned long hash;
+
+  /*the length of the string */
+  size_t len;
+
+  /*the string itself, terminated with a 0 */
+  char str[0];
+};				/*struct intern_name */
+/*---------------------------------------------------------------------------*/
+typedef struct intern_name intern_name_t;
+/*---------------------------------------------------------------------------*/
+
+/*---------------------------------------------------------------------------*/
+/*--------Functions----------------------------------------------------------*/
+/*Computes the hash of the first `len` characters of `str`*/
+unsigned long intern_hash (const char * str, size_t len);
+/*---------------------------------------------------------------------------*/
+/*Finds the interned copy of the first `len` characters of `str`,
+  creating it if required, and adds a reference to it*/
+error_t intern_get (const char * str, size_t len, intern_name_t ** name);
+/*---------------------------------------------------------------------------*/
+/*Removes a reference from `name`, freeing it if that was the last one*/
+void intern_release (intern_name_t * name);
+/*---------------------------------------------------------------------------*/
+/*Prints the counters of the table of names to `f`*/
+void intern_report (FILE * f);
+/*---------------------------------------------------------------------------*/
+#endif /*__INTERN_H__*/
@@ -55,19 +55,14 @@
 
 /*---------------------------------------------------------------------------*/
 /*--------Functions----------------------------------------------------------*/
-/*Fetches directory entries for `dir`*/
-error_t dir_entries_get (file_t dir,
-			 char **dirent_data, /*the list of directory
-					       entries as returned by
-					       dir_readdir */
-			 size_t * dirent_data_size,/*the size of
-						     `dirent_data` */
-			 struct dirent ***dirent_list/*the array of
-						       pointers to
-						       beginnings of
-						       dirents in
-						       dirent_data */
-			 );
+/*Returns the current time in milliseconds, read from the mapped time
+  page*/
+unsigned long time_ms (void);
+/*---------------------------------------------------------------------------*/
+/*Returns the current time in seconds, read from the mapped time page;
+  unlike time_ms, it can be compared with the times in stat
+  information*/
+time_t time_s (void);
 /*---------------------------------------------------------------------------*/
 /*Lookup `name` under `dir` (or cwd, if `dir` is invalid)*/
 error_t file_lookup (file_t dir, char *name,
@@ -27,42 +27,514 @@
 /*---------------------------------------------------------------------------*/
 #define _GNU_SOURCE
 /*---------------------------------------------------------------------------*/
+#include <unistd.h>
+/*---------------------------------------------------------------------------*/
 #include "lnode.h"
 #include "debug.h"
 #include "node.h"
+#include "nsmux.h"
+/*---------------------------------------------------------------------------*/
+
+/*---------------------------------------------------------------------------*/
+/*--------Global Variables---------------------------------------------------*/
+/*The allocator of lnodes*/
+slab_t lnode_slab = SLAB_INITIALIZER ("lnode", lnode_t);
+/*---------------------------------------------------------------------------*/
+/*The maximal number of proxy nodes of a single lnode (0 means no
+  limit)*/
+int lnode_proxies_max = LNODE_PROXIES_MAX;
+/*---------------------------------------------------------------------------*/
+/*The time (in milliseconds) for which a failed lookup is remembered
+  (0 disables the negative entries)*/
+int lnode_negative_ttl = LNODE_NEGATIVE_TTL;
+/*---------------------------------------------------------------------------*/
+/*The maximal number of negative entries of a single directory*/
+int lnode_negatives_max = LNODE_NEGATIVES_MAX;
+/*---------------------------------------------------------------------------*/
+/*The amount of memory (in bytes) the lnode tree may occupy before
+  idle lnodes start being pruned*/
+long lnode_memory_max = LNODE_MEMORY_MAX;
+/*---------------------------------------------------------------------------*/
+/*The number of lookups answered from and missed in the negative entries*/
+volatile unsigned long lnode_negative_hits;
+volatile unsigned long lnode_negative_misses;
+/*---------------------------------------------------------------------------*/
+/*The amount of memory occupied by all lnodes*/
+static volatile long lnode_memory;
+/*---------------------------------------------------------------------------*/
+/*The number of lnodes and the number of directories among them*/
+static volatile unsigned long lnode_count;
+static volatile unsigned long lnode_dirs;
+/*---------------------------------------------------------------------------*/
+/*The list of idle lnodes, the most recently released first, and its
+  length; protected by `lnode_reclaim_lock`*/
+static lnode_t *lnode_idle_head, *lnode_idle_tail;
+static unsigned long lnode_idle_count;
+/*---------------------------------------------------------------------------*/
+/*The lnodes whose last reference has been removed; a stack which is
+  pushed to without locks and emptied at once by the reclaimer*/
+static lnode_t *volatile lnode_retired = NULL;
+/*---------------------------------------------------------------------------*/
+/*The current epoch; only its parity matters*/
+static volatile unsigned long lnode_epoch = 0;
+/*---------------------------------------------------------------------------*/
+/*The number of threads inside sections started in an even and in an
+  odd epoch*/
+static volatile int lnode_epoch_readers[2];
+/*---------------------------------------------------------------------------*/
+/*The hash indices which have been replaced and may still be read by
+  lock-free lookups; a stack like `lnode_retired`*/
+static lnode_htable_t *volatile lnode_htables_retired = NULL;
+/*---------------------------------------------------------------------------*/
+/*The lock serializing the rounds of reclamation*/
+static struct mutex lnode_reclaim_lock = MUTEX_INITIALIZER;
 /*---------------------------------------------------------------------------*/
 
 /*---------------------------------------------------------------------------*/
 /*--------Functions----------------------------------------------------------*/
-/*Adds a reference to the `lnode` (which must be locked)*/
+/*Takes into account that the memory occupied by `node` has changed
+  by `delta` bytes*/
+static void lnode_memory_add (lnode_t * node, long delta)
+{
+  __sync_fetch_and_add (&node->memory, delta);
+  __sync_fetch_and_add (&lnode_memory, delta);
+}				/*lnode_memory_add */
+
+/*---------------------------------------------------------------------------*/
+/*Puts `node` at the head of the list of idle lnodes, removing it from
+  its current position if required; `lnode_reclaim_lock` must be held*/
+static void lnode_idle_insert (lnode_t * node)
+{
+  /*If the node is already idle, take it out of its old position */
+  if (node->idle)
+    {
+      if (node->idle_prev)
+	node->idle_prev->idle_next = node->idle_next;
+      else
+	lnode_idle_head = node->idle_next;
+      if (node->idle_next)
+	node->idle_next->idle_prev = node->idle_prev;
+      else
+	lnode_idle_tail = node->idle_prev;
+    }
+  else
+    ++lnode_idle_count;
+
+  /*Put the node at the head */
+  node->idle_prev = NULL;
+  node->idle_next = lnode_idle_head;
+  if (lnode_idle_head)
+    lnode_idle_head->idle_prev = node;
+  else
+    lnode_idle_tail = node;
+  lnode_idle_head = node;
+  node->idle = 1;
+}				/*lnode_idle_insert */
+
+/*---------------------------------------------------------------------------*/
+/*Removes `node` from the list of idle lnodes, if it is there;
+  `lnode_reclaim_lock` must be held*/
+static void lnode_idle_remove (lnode_t * node)
+{
+  if (!node->idle)
+    return;
+
+  if (node->idle_prev)
+    node->idle_prev->idle_next = node->idle_next;
+  else
+    lnode_idle_head = node->idle_next;
+  if (node->idle_next)
+    node->idle_next->idle_prev = node->idle_prev;
+  else
+    lnode_idle_tail = node->idle_prev;
+
+  node->idle_next = node->idle_prev = NULL;
+  node->idle = 0;
+  --lnode_idle_count;
+}				/*lnode_idle_remove */
+
+/*---------------------------------------------------------------------------*/
+/*Queues the hash index `htable`, which has just been replaced, to be
+  freed by the reclaimer*/
+static void lnode_htable_retire (lnode_htable_t * htable)
+{
+  /*The current top of the stack of retired indices */
+  lnode_htable_t *top;
+
+  do
+    {
+      top = lnode_htables_retired;
+      htable->retired_next = top;
+    }
+  while (!__sync_bool_compare_and_swap (&lnode_htables_retired, top, htable));
+}				/*lnode_htable_retire */
+
+/*---------------------------------------------------------------------------*/
+/*Rehashes the entries of `dir` into a new hash index with `size`
+  buckets. Lock-free readers may still be walking the old index, so it
+  is handed to the reclaimer instead of being freed*/
+static error_t lnode_htable_resize (lnode_t * dir, size_t size)
+{
+  /*The new hash index */
+  lnode_htable_t *htable = calloc
+    (1, sizeof (lnode_htable_t) + size * sizeof (lnode_t *));
+  if (!htable)
+    return ENOMEM;
+  htable->size = size;
+
+  /*A pointer to an entry of `dir` */
+  lnode_t *n;
+
+  /*The old index */
+  lnode_htable_t *old = dir->htable;
+
+  /*Put every entry of `dir` into the bucket it belongs to. A reader
+     walking an old bucket meanwhile may be led into a new one and miss
+     an entry, but will always reach the end of a bucket */
+  for (n = dir->entries; n; n = n->next)
+    {
+      n->hnext = htable->buckets[n->iname->hash & (size - 1)];
+      htable->buckets[n->iname->hash & (size - 1)] = n;
+    }
+
+  /*Publish the new index only when it is complete */
+  __sync_synchronize ();
+  dir->htable = htable;
+
+  /*Let the reclaimer free the old index */
+  lnode_memory_add (dir, size * sizeof (lnode_t *));
+  if (old)
+    {
+      lnode_memory_add (dir, -(long) (old->size * sizeof (lnode_t *)));
+      lnode_htable_retire (old);
+    }
+
+  return 0;
+}				/*lnode_htable_resize */
+
+/*---------------------------------------------------------------------------*/
+/*Queues `node`, whose last reference has just been removed, for the
+  reclaimer, unless it has already been queued*/
+static void lnode_retire (lnode_t * node)
+{
+  /*The current top of the stack of retired lnodes */
+  lnode_t *top;
+
+  /*If the node is already waiting for the reclaimer, do nothing */
+  if (!__sync_bool_compare_and_swap (&node->retired, 0, 1))
+    return;
+
+  /*Push the node onto the stack of retired lnodes */
+  do
+    {
+      top = lnode_retired;
+      node->reclaim_next = top;
+    }
+  while (!__sync_bool_compare_and_swap (&lnode_retired, top, node));
+}				/*lnode_retire */
+
+/*---------------------------------------------------------------------------*/
+/*Adds a reference to `node` unless the node has been claimed by the
+  reclaimer; returns nonzero on success*/
+static int lnode_ref_get (lnode_t * node)
+{
+  /*The number of references observed */
+  int refs;
+
+  do
+    {
+      refs = node->references;
+
+      /*If the node is being destroyed, it cannot be referenced */
+      if (refs == LNODE_REFS_DEAD)
+	return 0;
+    }
+  while (!__sync_bool_compare_and_swap (&node->references, refs, refs + 1));
+
+  return 1;
+}				/*lnode_ref_get */
+
+/*---------------------------------------------------------------------------*/
+/*Adds a reference to the `lnode`. The caller must already hold a
+  reference to `node` (possibly through a node or an entry of it)*/
 void lnode_ref_add (lnode_t * node)
 {
   /*Increment the number of references */
-  ++node->references;
+  __sync_fetch_and_add (&node->references, 1);
 }				/*lnode_ref_add */
 
 /*---------------------------------------------------------------------------*/
-/*Removes a reference from `node` (which must be locked). If that was
-  the last reference, destroy the node*/
+/*Removes a reference from `node`. If that was the last reference,
+  queue the node for the reclaimer, which will keep it idle and
+  uninstall and destroy it when the tree grows too large, unless it is
+  referenced again meanwhile. Does not lock or unlock anything*/
 void lnode_ref_remove (lnode_t * node)
 {
-  /*Fail if the node is not referenced by anybody */
-  assert (node->references);
-
   /*Decrement the number of references to `node` */
-  --node->references;
+  int refs = __sync_sub_and_fetch (&node->references, 1);
+
+  /*Fail if the node was not referenced by anybody */
+  assert (refs >= 0);
+
+  /*If there are no references remaining, let the reclaimer decide */
+  if (refs == 0)
+    lnode_retire (node);
+}				/*lnode_ref_remove */
+
+/*---------------------------------------------------------------------------*/
+/*Marks the beginning of a section in which the current thread may
+  access lnodes it holds no references to; returns the value to be
+  passed to lnode_epoch_exit*/
+int lnode_epoch_enter (void)
+{
+  /*The parity of the epoch we are registering in */
+  int epoch;
 
-  /*If there are no references remaining */
-  if (node->references == 0)
+  for (;;)
     {
-      /*uninstall the node from the directory it is in and destroy it */
-      lnode_uninstall (node);
+      epoch = lnode_epoch & 1;
+
+      /*count ourselves in the current epoch */
+      __sync_fetch_and_add (&lnode_epoch_readers[epoch], 1);
+
+      /*If the epoch has not changed meanwhile, we are properly counted */
+      if ((lnode_epoch & 1) == epoch)
+	return epoch;
+
+      /*otherwise try again in the new epoch */
+      __sync_fetch_and_sub (&lnode_epoch_readers[epoch], 1);
+    }
+}				/*lnode_epoch_enter */
+
+/*---------------------------------------------------------------------------*/
+/*Marks the end of the section started by lnode_epoch_enter*/
+void lnode_epoch_exit (int epoch)
+{
+  __sync_fetch_and_sub (&lnode_epoch_readers[epoch], 1);
+}				/*lnode_epoch_exit */
+
+/*---------------------------------------------------------------------------*/
+/*Waits until every thread which might have seen an lnode uninstalled
+  before the call has left its epoch section*/
+static void lnode_epoch_synchronize (void)
+{
+  /*The parity of the epoch which is ending */
+  int epoch = lnode_epoch & 1;
+
+  /*Start a new epoch; new sections will be counted separately */
+  __sync_fetch_and_add (&lnode_epoch, 1);
+
+  /*Wait for the sections started in the old epoch to finish */
+  while (lnode_epoch_readers[epoch])
+    cthread_yield ();
+}				/*lnode_epoch_synchronize */
+
+/*---------------------------------------------------------------------------*/
+/*Moves the lnodes which have been released since the previous call
+  and have not been referenced again to the list of idle lnodes, and
+  uninstalls and destroys the least recently used idle lnodes while
+  the tree occupies more than `lnode_memory_max` bytes*/
+void lnode_reclaim (void)
+{
+  lnode_reclaim_to (lnode_memory_max);
+}				/*lnode_reclaim */
+
+/*---------------------------------------------------------------------------*/
+/*Does the work of lnode_reclaim, pruning the idle lnodes while the tree
+  occupies more than `limit` bytes*/
+void lnode_reclaim_to (long limit)
+{
+  /*The lnodes to examine, the current one and the next one */
+  lnode_t *batch, *node, *next;
+
+  /*The lnodes which will be destroyed */
+  lnode_t *dead = NULL;
+
+  /*The directory of the current lnode */
+  lnode_t *dir;
+
+  /*The replaced hash indices and the next one of them */
+  lnode_htable_t *htables, *htable_next;
+
+  /*The number of bytes by which the tree exceeds its budget, not
+     counting the lnodes already claimed */
+  long excess;
+
+  mutex_lock (&lnode_reclaim_lock);
+
+  /*Take all retired lnodes at once */
+  batch = __sync_lock_test_and_set (&lnode_retired, NULL);
+
+  for (node = batch; node; node = next)
+    {
+      next = node->reclaim_next;
+
+      /*If the node cannot be found by lookups, there is no point in
+         keeping it; claim it at once, while it is still marked as
+         queued, so that it cannot be queued again */
+      if (!node->dir
+	  && __sync_bool_compare_and_swap
+	  (&node->references, 0, LNODE_REFS_DEAD))
+	{
+	  lnode_idle_remove (node);
+	  node->reclaim_next = dead;
+	  dead = node;
+	  continue;
+	}
+
+      /*whoever removes the last reference from now on will queue the
+         node anew */
+      node->retired = 0;
+      __sync_synchronize ();
+
+      /*If the node is in use again, it is not idle any longer;
+         otherwise keep it around while there is enough memory, in case
+         it is looked up again soon */
+      if (node->references != 0)
+	lnode_idle_remove (node);
+      else
+	lnode_idle_insert (node);
+    }
+
+  /*While the tree occupies too much memory, prune the least recently
+     used idle lnodes. An idle lnode has no entries (they would hold
+     references to it), so only leaves are pruned; their directories
+     become idle when the last entry is gone */
+  for (excess = lnode_memory - limit;
+       (excess > 0) && lnode_idle_tail;)
+    {
+      node = lnode_idle_tail;
+      lnode_idle_remove (node);
+      dir = node->dir;
+
+      /*Mark the node as queued while trying to claim it, so that it
+         is not queued concurrently; if it is queued already, it has
+         been used recently, and the next round will make it idle again */
+      if (!__sync_bool_compare_and_swap (&node->retired, 0, 1))
+	continue;
+
+      /*Lookups find entries without locks and refuse claimed ones;
+         the directory is locked only to serialize the uninstallation
+         with the other writers */
+      if (dir)
+	mutex_lock (&dir->lock);
+
+      /*If nobody has referenced the node again, claim it */
+      if (__sync_bool_compare_and_swap
+	  (&node->references, 0, LNODE_REFS_DEAD))
+	{
+	  /*make the node unreachable for new lookups */
+	  if (dir)
+	    lnode_uninstall (node);
+
+	  excess -= node->memory;
+	  node->reclaim_next = dead;
+	  dead = node;
+	}
+      else
+	{
+	  /*the node is in use; whoever removes the last reference will
+	     queue it anew */
+	  node->retired = 0;
+	  __sync_synchronize ();
+
+	  /*If the last reference was removed while the node still looked
+	     queued, queue it ourselves */
+	  if (node->references == 0)
+	    lnode_retire (node);
+	}
+
+      if (dir)
+	mutex_unlock (&dir->lock);
+    }
+
+  /*Take all replaced hash indices, too */
+  htables = __sync_lock_test_and_set (&lnode_htables_retired, NULL);
+
+  /*Let the threads which might still be looking at the claimed lnodes
+     or at the replaced indices finish */
+  if (dead || htables)
+    lnode_epoch_synchronize ();
+
+  /*Free the replaced indices */
+  for (; htables; htables = htable_next)
+    {
+      htable_next = htables->retired_next;
+      free (htables);
+    }
+
+  /*Destroy the claimed lnodes */
+  for (node = dead; node; node = next)
+    {
+      next = node->reclaim_next;
+      dir = node->dir;
+
       lnode_destroy (node);
+
+      /*Release the reference held by the node to its directory; if
+         this was the last one, the directory will become idle in the
+         next round */
+      if (dir)
+	lnode_ref_remove (dir);
     }
-  else
-    /*simply unlock the node */
-    mutex_unlock (&node->lock);
-}				/*lnode_ref_remove */
+
+  mutex_unlock (&lnode_reclaim_lock);
+}				/*lnode_reclaim_to */
+
+/*---------------------------------------------------------------------------*/
+/*Returns the number of bytes occupied by the lnode tree*/
+long lnode_memory_used (void)
+{
+  return lnode_memory;
+}				/*lnode_memory_used */
+
+/*---------------------------------------------------------------------------*/
+/*The body of the thread which periodically reclaims lnodes*/
+static void *lnode_reclaim_thread (void *arg)
+{
+  for (;;)
+    {
+      usleep (LNODE_RECLAIM_INTERVAL * 1000);
+      lnode_reclaim ();
+    }
+
+  return NULL;
+}				/*lnode_reclaim_thread */
+
+/*---------------------------------------------------------------------------*/
+/*Starts the thread which periodically calls lnode_reclaim*/
+void lnode_reclaim_init (void)
+{
+  cthread_detach (cthread_fork ((cthread_fn_t) lnode_reclaim_thread, 0));
+}				/*lnode_reclaim_init */
+
+/*---------------------------------------------------------------------------*/
+/*Marks `node` as a directory or as a file*/
+void lnode_set_dir (lnode_t * node, int isdir)
+{
+  /*If the node is becoming a directory */
+  if (isdir && !(node->flags & FLAG_LNODE_DIR))
+    {
+      node->flags |= FLAG_LNODE_DIR;
+      __sync_fetch_and_add (&lnode_dirs, 1);
+    }
+  /*If the node is ceasing to be a directory */
+  else if (!isdir && (node->flags & FLAG_LNODE_DIR))
+    {
+      node->flags &= ~FLAG_LNODE_DIR;
+      __sync_fetch_and_sub (&lnode_dirs, 1);
+    }
+}				/*lnode_set_dir */
+
+/*---------------------------------------------------------------------------*/
+/*Prints the counters of the lnode tree to `f`*/
+void lnode_report (FILE * f)
+{
+  fprintf (f, "lnodes: %lu (%lu directories, %lu files, %lu idle), "
+	   "%ld bytes of %ld allowed\n", lnode_count, lnode_dirs,
+	   lnode_count - lnode_dirs, lnode_idle_count, lnode_memory,
+	   lnode_memory_max);
+}				/*lnode_report */
 
 /*---------------------------------------------------------------------------*/
 /*Creates a new lnode with `name`; the new node is locked and contains
@@ -70,7 +542,7 @@ void lnode_ref_remove (lnode_t * node)
 error_t lnode_create (char *name, lnode_t ** node)
 {
   /*Allocate the memory for the node */
-  lnode_t *node_new = malloc (sizeof (lnode_t));
+  lnode_t *node_new = slab_alloc (&lnode_slab);
 
   /*If the memory has not been allocated */
   if (!node_new)
@@ -79,34 +551,32 @@ error_t lnode_create (char *name, lnode_t ** node)
       return ENOMEM;
     }
 
-  /*The copy of the name */
-  char *name_cp = NULL;
+  /*Setup the new node */
+  memset (node_new, 0, sizeof (lnode_t));
 
-  /*If the name exists */
+  /*If the name exists, reference its interned copy */
   if (name)
     {
-      /*duplicate it */
-      name_cp = strdup (name);
-
-      /*If the name has not been duplicated */
-      if (!name_cp)
+      /*If the name could not be interned */
+      if (intern_get (name, strlen (name), &node_new->iname))
 	{
 	  /*free the node */
-	  free (node_new);
+	  slab_free (&lnode_slab, node_new);
 
 	  /*stop */
 	  return ENOMEM;
 	}
-    }
 
-  /*Setup the new node */
-  memset (node_new, 0, sizeof (lnode_t));
-  node_new->name = name_cp;
-  node_new->name_len = (name_cp) ? (strlen (name_cp)) : (0);
+      node_new->name = node_new->iname->str;
+    }
 
   /*Setup one reference to this lnode */
   node_new->references = 1;
 
+  /*Count the new lnode */
+  __sync_fetch_and_add (&lnode_count, 1);
+  lnode_memory_add (node_new, lnode_slab.size);
+
   /*Initialize the mutex and acquire a lock on this lnode */
   mutex_init (&node_new->lock);
   mutex_lock (&node_new->lock);
@@ -122,106 +592,147 @@ error_t lnode_create (char *name, lnode_t ** node)
 /*Destroys the given lnode*/
 void lnode_destroy (lnode_t * node)
 {
-  /*Destroy the name of the node */
-  free (node->name);
+  /*Release the name of the node */
+  if (node->iname)
+    intern_release (node->iname);
 
-  /*While the list of proxies has not been freed */
-  node_list_t p;
-  for (p = node->proxies; p;)
-    {
-      /*shift the pointer to the head of the list forward */
-      node->proxies = node->proxies->next;
+  /*Destroy the hash index of the entries */
+  free ((void *) node->htable);
 
-      /*drop the current cell in the list */
-      free (p);
+  /*Destroy the cached path */
+  free (node->path);
 
-      /*store the current proxy */
-      p = node->proxies;
-    }
+  /*Destroy the negative entries */
+  lnode_negative_flush (node);
+
+  /*Count the removal of the lnode */
+  __sync_fetch_and_sub (&lnode_count, 1);
+  if (node->flags & FLAG_LNODE_DIR)
+    __sync_fetch_and_sub (&lnode_dirs, 1);
+  __sync_fetch_and_sub (&lnode_memory, node->memory);
 
   /*Destroy the node itself */
-  free (node);
+  slab_free (&lnode_slab, node);
 }				/*lnode_destroy */
 
 /*---------------------------------------------------------------------------*/
 /*Constructs the full path for the given lnode and stores the result
   both in the parameter and inside the lnode (the same string,
-  actually)*/
+  actually). The path is built only once, from the cached path of the
+  parent, and may be read without locking once it is set*/
 error_t lnode_path_construct (lnode_t * node, char **path)
 {
   error_t err = 0;
 
-  /*The final path */
+  /*The final path and its length */
   char *p;
+  size_t len;
 
-  /*The final length of the path */
-  int p_len = 0;
-
-  /*A temporary pointer to an lnode */
-  lnode_t *n;
+  /*If we are at the root node of the proxy filesystem or the path has
+     already been built, there is nothing to build; nsmux does not
+     rename files, so a path never changes once it is set */
+  if (!node->dir || node->path)
+    {
+      if (path)
+	*path = node->path;
+      return 0;
+    }
 
-  /*While the root node of the proxy filesystem has not been reached */
-  for (n = node; n && n->dir; n = n->dir)
-    /*add the length of the name of `n` to `p_len` make some space for
-       the delimiter '/', if we are not approaching the root node */
-    /*p_len += n->name_len + ((n->dir->dir) ? (1) : (0)); */
-    /*There is some path to our root node, so we will anyway have to
-       add a '/' */
-    p_len += n->name_len + 1;
-
-  /*Include the space for the path to the root node of the proxy
-     (n is now the root of the filesystem) */
-  p_len += strlen (n->path) + 1;
-
-  /*Try to allocate the space for the string */
-  p = malloc (p_len * sizeof (char));
+  /*Make sure the path to the parent is built (normally it is, so this
+     does not walk up the tree); the parent is not locked, since it may
+     be locked before its entries, but its path is published at once */
+  err = lnode_path_construct (node->dir, NULL);
+  if (err)
+    return err;
+
+  /*Try to allocate the space for the string: the path to the parent,
+     the separator, the name and the terminal 0 */
+  len = node->dir->path_len + 1 + node->iname->len;
+  p = malloc (len + 1);
   if (!p)
-    err = ENOMEM;
-  /*If memory allocation has been successful */
+    return ENOMEM;
+
+  /*Put the path to the parent, the separator and the name together */
+  memcpy (p, node->dir->path, node->dir->path_len);
+  p[node->dir->path_len] = '/';
+  memcpy (p + node->dir->path_len + 1, node->name, node->iname->len);
+  p[len] = 0;
+
+  /*Publish the path; if another thread has built the same path in the
+     meantime, keep that one. The length is the same for both, so it
+     may be stored before the path */
+  node->path_len = len;
+  if (__sync_bool_compare_and_swap (&node->path, NULL, p))
+    lnode_memory_add (node, len + 1);
   else
-    {
-      /*put a terminal 0 at the end of the path */
-      p[--p_len] = 0;
+    free (p);
 
-      /*While the root node of the proxy filesystem has not been reached */
-      for (n = node; n && n->dir; n = n->dir)
-	{
-	  /*compute the position where the name of `n` is to be inserted */
-	  p_len -= n->name_len;
-
-	  /*copy the name of the node into the path (omit the terminal 0) */
-	  strncpy (p + p_len, n->name, n->name_len);
-
-	  /*If we are not at the root node of the proxy filesystem, add the
-	     separator */
-	  /*if(n->dir->dir)
-	     p[--p_len] = '/'; */
-	  /*we anyway have to add the separator slash */
-	  p[--p_len] = '/';
-	}
+  /*store the path in the parameter */
+  if (path)
+    *path = node->path;
 
-      /*put the path to the root node at the beginning of the first path
-         (n is at the root now) */
-      strncpy (p, n->path, strlen (n->path));
+  /*Return the result of operations */
+  return err;
+}				/*lnode_path_construct */
 
-      /*destroy the former path in lnode, if it exists */
-      if (node->path)
-	free (node->path);
+/*---------------------------------------------------------------------------*/
+/*Finds the entry `name` of `dir` without locking anything; the caller
+  must be inside an epoch (see lnode_epoch_enter)*/
+static lnode_t *lnode_find (lnode_t * dir, char *name)
+{
+  /*The entry being examined */
+  lnode_t *n = NULL;
+
+  /*The length and the hash of `name` */
+  size_t name_len = strlen (name);
+  unsigned long hash = intern_hash (name, name_len);
+
+  /*The hash index of `dir` */
+  lnode_htable_t *htable;
+
+  /*If `dir` contains any entries, find `name` in the corresponding
+     bucket of the hash index. Entries are published only after being
+     set up completely, so they can be examined without locks. The
+     interned name cannot be used here, since finding it requires a
+     lock; the comparison of the hashes rejects the other names anyway */
+  htable = dir->htable;
+  if (htable)
+    for (n = htable->buckets[hash & (htable->size - 1)]; n; n = n->hnext)
+      if ((n->iname->hash == hash) && (n->iname->len == name_len)
+	  && (memcmp (n->name, name, name_len) == 0))
+	break;
+
+  return n;
+}				/*lnode_find */
 
-      /*store the new path inside the lnode */
-      node->path = p;
+/*---------------------------------------------------------------------------*/
+/*Checks whether the entry `name` of `dir` was a directory when it was
+  last looked up (or when the snapshot it was restored from was made);
+  nothing is locked, so the answer is only a hint*/
+int lnode_is_dir (lnode_t * dir, char *name)
+{
+  /*The entry found */
+  lnode_t *n;
 
-      /*store the path in the parameter */
-      if (path)
-	*path = p;
-    }
+  /*Is it a directory? */
+  int isdir;
 
-  /*Return the result of operations */
-  return err;
-}				/*lnode_path_construct */
+  /*Keep the entry from being freed while looking at it */
+  int epoch = lnode_epoch_enter ();
+
+  n = lnode_find (dir, name);
+  isdir = n && (n->flags & FLAG_LNODE_DIR);
+
+  lnode_epoch_exit (epoch);
+
+  return isdir;
+}				/*lnode_is_dir */
 
 /*---------------------------------------------------------------------------*/
-/*Gets a light node by its name, locks it and increments its refcount*/
+/*Gets a light node by its name, locks it and increments its refcount.
+  `dir` need not be locked: the entries are looked up without locks,
+  so an entry installed concurrently may be missed; callers wishing to
+  install `name` must retry with `dir` locked*/
 error_t lnode_get (lnode_t * dir,	/*search here */
 		   char *name,	/*search for this name */
 		   lnode_t ** node	/*put the result here */
@@ -232,23 +743,30 @@ error_t lnode_get (lnode_t * dir,	/*search here */
   /*The pointer to the required lnode */
   lnode_t *n;
 
-  /*Find `name` among the names of entries in `dir` */
-  for (n = dir->entries; n && (strcmp (n->name, name) != 0); n = n->next);
+  /*The entries found may be unreferenced; keep them, and the index,
+     from being freed while we are looking at them */
+  int epoch = lnode_epoch_enter ();
+
+  /*Find `name` in `dir` without locks */
+  n = lnode_find (dir, name);
 
-  /*If the search has been successful */
-  if (n)
+  /*If the search has been successful and the found lnode is not
+     being destroyed, increment its refcount */
+  if (n && lnode_ref_get (n))
     {
+      lnode_epoch_exit (epoch);
+
       /*lock the node */
       mutex_lock (&n->lock);
 
-      /*increment the refcount of the found lnode */
-      lnode_ref_add (n);
-
       /*put a pointer to `n` into the parameter */
       *node = n;
     }
   else
-    err = ENOENT;
+    {
+      lnode_epoch_exit (epoch);
+      err = ENOENT;
+    }
 
   /*Return the result of operations */
   return err;
@@ -257,10 +775,32 @@ error_t lnode_get (lnode_t * dir,	/*search here */
 /*---------------------------------------------------------------------------*/
 /*Install the lnode into the lnode tree: add a reference to `dir`
   (which must be locked)*/
-void lnode_install (lnode_t * dir,	/*install here */
-		    lnode_t * node	/*install this */
+error_t lnode_install (lnode_t * dir,	/*install here */
+		       lnode_t * node	/*install this */
   )
 {
+  error_t err;
+
+  /*If `dir` has no hash index yet, create one */
+  if (!dir->htable)
+    {
+      err = lnode_htable_resize (dir, LNODE_HTABLE_SIZE_INIT);
+      if (err)
+	return err;
+    }
+  /*If the buckets are getting too long, try to double their number;
+     a failure only makes the lookups slower, so ignore it */
+  else if (dir->entries_count >= dir->htable->size * LNODE_HTABLE_LOAD_MAX)
+    lnode_htable_resize (dir, dir->htable->size * 2);
+
+  /*The bucket `node` belongs to */
+  lnode_t *volatile *bucket =
+    &dir->htable->buckets[node->iname->hash & (dir->htable->size - 1)];
+
+  /*Setup the `dir` link in node and add a new reference to dir */
+  node->dir = dir;
+  lnode_ref_add (dir);
+
   /*Install `node` into the list of entries in `dir` */
   node->next = dir->entries;
   node->prevp = &dir->entries;	/*this node is the first on the list */
@@ -269,20 +809,38 @@ void lnode_install (lnode_t * dir,	/*install here */
 					   corresponding to its meaning */
   dir->entries = node;
 
-  /*Add a new reference to dir */
-  lnode_ref_add (dir);
+  /*Put `node` into the corresponding bucket of the hash index; the
+     node must be visible to lock-free lookups only after everything
+     in it has been set up */
+  node->hnext = *bucket;
+  __sync_synchronize ();
+  *bucket = node;
 
-  /*Setup the `dir` link in node */
-  node->dir = dir;
+  /*Count the new entry */
+  ++dir->entries_count;
+
+  return 0;
 }				/*lnode_install */
 
 /*---------------------------------------------------------------------------*/
-/*Unistall the node from the node tree; remove a reference from the
-  lnode containing `node`*/
+/*Unistall the node from the node tree; the directory containing
+  `node` must be locked. The reference held by `node` to the directory
+  is not removed*/
 void lnode_uninstall (lnode_t * node)
 {
-  /*Remove a reference from the parent */
-  lnode_ref_remove (node->dir);
+  /*The pointer to `node` in the bucket of the hash index of the parent */
+  lnode_t *volatile *hp;
+
+  /*Find `node` in its bucket and unlink it from the bucket; `hnext`
+     of `node` is left intact for the lookups which are still walking
+     through it */
+  for (hp = &node->dir->htable->buckets[node->iname->hash
+					& (node->dir->htable->size - 1)];
+       *hp != node; hp = &(*hp)->hnext);
+  *hp = node->hnext;
+
+  /*Count the removal of the entry */
+  --node->dir->entries_count;
 
   /*Make the next pointer in the previous element point to the element,
      which follows `node` */
@@ -294,18 +852,162 @@ void lnode_uninstall (lnode_t * node)
     node->next->prevp = &node->next;
 }				/*lnode_uninstall */
 
+/*---------------------------------------------------------------------------*/
+/*Frees the negative entry `neg` of `dir`, which has already been
+  unlinked*/
+static void lnode_negative_free (lnode_t * dir, lnode_negative_t * neg)
+{
+  lnode_memory_add (dir, -(long) (sizeof (lnode_negative_t) + neg->name_len));
+  free (neg);
+}				/*lnode_negative_free */
+
+/*---------------------------------------------------------------------------*/
+/*Checks whether `name` is known not to exist in `dir` (which must be
+  locked and whose modification time is `mtime`); returns nonzero if
+  so. Stale entries are dropped on the way*/
+int lnode_negative_lookup (lnode_t * dir, const char * name, time_t mtime)
+{
+  /*The length and the hash of `name` */
+  size_t name_len;
+  unsigned long hash;
+
+  /*The current time */
+  unsigned long now;
+
+  /*The negative entry being examined and the link pointing to it */
+  lnode_negative_t *neg, **prevp;
+
+  /*If the negative entries are disabled, there is nothing to find */
+  if (lnode_negative_ttl <= 0)
+    return 0;
+
+  /*If the directory has changed since the entries were recorded, they
+     cannot be trusted any longer */
+  if (dir->negatives && (dir->negatives_mtime != mtime))
+    lnode_negative_flush (dir);
+
+  /*If there are no entries, the lookup misses right away */
+  if (!dir->negatives)
+    {
+      __sync_fetch_and_add (&lnode_negative_misses, 1);
+      return 0;
+    }
+
+  name_len = strlen (name);
+  hash = intern_hash (name, name_len);
+  now = time_ms ();
+
+  /*Go through the entries, dropping the expired ones */
+  for (prevp = &dir->negatives; (neg = *prevp);)
+    {
+      if ((long) (now - neg->expires) >= 0)
+	{
+	  /*the entry has expired; remove it */
+	  *prevp = neg->next;
+	  --dir->negatives_count;
+	  lnode_negative_free (dir, neg);
+	  continue;
+	}
+
+      /*If this is the entry for `name`, the lookup hits */
+      if ((neg->name_hash == hash) && (neg->name_len == name_len)
+	  && (memcmp (neg->name, name, name_len) == 0))
+	{
+	  __sync_fetch_and_add (&lnode_negative_hits, 1);
+	  return 1;
+	}
+
+      prevp = &neg->next;
+    }
+
+  /*`name` has not been found */
+  __sync_fetch_and_add (&lnode_negative_misses, 1);
+  return 0;
+}				/*lnode_negative_lookup */
+
+/*---------------------------------------------------------------------------*/
+/*Remembers that `name` does not exist in `dir` (which must be locked
+  and whose modification time is `mtime`)*/
+void lnode_negative_add (lnode_t * dir, const char * name, time_t mtime)
+{
+  /*The new entry */
+  lnode_negative_t *neg;
+
+  /*The length of `name` */
+  size_t name_len;
+
+  /*The last entry to be kept and the number of entries kept so far */
+  lnode_negative_t *last;
+  int kept;
+
+  /*If the negative entries are disabled, do nothing */
+  if ((lnode_negative_ttl <= 0) || (lnode_negatives_max <= 0))
+    return;
+
+  /*If the directory has changed since the entries were recorded, drop
+     them */
+  if (dir->negatives && (dir->negatives_mtime != mtime))
+    lnode_negative_flush (dir);
+
+  /*Create the new entry; it is only an optimization, so a failure is
+     not an error */
+  name_len = strlen (name);
+  neg = malloc (sizeof (lnode_negative_t) + name_len);
+  if (!neg)
+    return;
+  lnode_memory_add (dir, sizeof (lnode_negative_t) + name_len);
+
+  neg->name_hash = intern_hash (name, name_len);
+  neg->name_len = name_len;
+  neg->expires = time_ms () + lnode_negative_ttl;
+  memcpy (neg->name, name, name_len);
+
+  /*Put the entry at the head of the list */
+  neg->next = dir->negatives;
+  dir->negatives = neg;
+  dir->negatives_mtime = mtime;
+
+  /*If there are too many entries now, drop the oldest ones (at the
+     tail of the list) */
+  if (++dir->negatives_count > lnode_negatives_max)
+    {
+      /*find the last entry to be kept */
+      for (last = dir->negatives, kept = 1; kept < lnode_negatives_max;
+	   last = last->next, ++kept);
+
+      /*free the entries after it */
+      while ((neg = last->next))
+	{
+	  last->next = neg->next;
+	  lnode_negative_free (dir, neg);
+	}
+
+      dir->negatives_count = kept;
+    }
+}				/*lnode_negative_add */
+
+/*---------------------------------------------------------------------------*/
+/*Drops all negative entries of `dir` (which must be locked)*/
+void lnode_negative_flush (lnode_t * dir)
+{
+  /*The entry being removed */
+  lnode_negative_t *neg;
+
+  /*Free every entry */
+  while ((neg = dir->negatives))
+    {
+      dir->negatives = neg->next;
+      lnode_negative_free (dir, neg);
+    }
+
+  dir->negatives_count = 0;
+}				/*lnode_negative_flush */
+
 /*---------------------------------------------------------------------------*/
 /*Makes the specified lnode aware of another proxy. Both `node` and
   `proxy` must be locked*/
 error_t lnode_add_proxy (lnode_t * node, node_t * proxy)
 {
-  /*TODO: Make the list of proxies finite */
-
-  /*Create an new cell in the list of proxies */
-  node_list_t p = malloc (sizeof (node_list_t));
-  if (!p)
-    return ENOMEM;
-
   /*If the supplied node references an lnode already
      (this should always happen, though) */
   if (proxy->nn->lnode)
@@ -315,12 +1017,15 @@ error_t lnode_add_proxy (lnode_t * node, node_t * proxy)
   /*Connect the proxy to the lnode */
   proxy->nn->lnode = node;
 
-  /*Store the pointer to the proxy in the new cell */
-  p->node = proxy;
+  /*Add the proxy at the beginning of the list of proxies */
+  proxy->nn->proxy_next = node->proxies;
+  proxy->nn->proxy_prevp = &node->proxies;
+  if (node->proxies)
+    node->proxies->nn->proxy_prevp = &proxy->nn->proxy_next;
+  node->proxies = proxy;
 
-  /*Add the new cell to the list of proxies */
-  p->next = node->proxies;
-  node->proxies = p;
+  /*Count the new proxy */
+  ++node->proxies_count;
 
   /*Count a new reference to this lnode */
   lnode_ref_add (node);
@@ -334,64 +1039,25 @@ error_t lnode_add_proxy (lnode_t * node, node_t * proxy)
   `proxy` must not be locked*/
 void lnode_remove_proxy (lnode_t * node, node_t * proxy)
 {
-  /*A pointer to a cell in the list of proxies */
-  node_list_t p;
-
   /*Lock the lnode */
   mutex_lock (&node->lock);
 
-  /*If the first cell in the list contains a reference to `proxy` */
-  if (node->proxies->node == proxy)
-    {
-      /*store a pointer to the head of the list */
-      p = node->proxies;
-
-      /*shift the head of the list forward */
-      node->proxies = node->proxies->next;
-
-      /*destroy the former head */
-      free (p);
-
-      /*remove a reference from the supplied lnode */
-      lnode_ref_remove (node);
-
-      /*stop right here */
-      mutex_unlock (&node->lock);
-      return;
-    }
-
-  /*Another pointer to a cell in the list */
-  node_list_t q;
-
-  /*Go through the list of proxy nodes of the given lnode */
-  for (p = node->proxies; p->next; p = p->next)
-    {
-      /*If the next cell does not contain a reference to the same node,
-         as specified in the parameter, skip this entry */
-      if (p->next->node != proxy)
-	continue;
+  /*Unlink the proxy from the list */
+  *proxy->nn->proxy_prevp = proxy->nn->proxy_next;
+  if (proxy->nn->proxy_next)
+    proxy->nn->proxy_next->nn->proxy_prevp = proxy->nn->proxy_prevp;
+  proxy->nn->proxy_next = NULL;
+  proxy->nn->proxy_prevp = NULL;
 
-      /*store a copy of the next element */
-      q = p->next;
+  /*Count the removal of the proxy */
+  --node->proxies_count;
 
-      /*unregister the next element from the list */
-      p->next = q->next;
-
-      /*remove the unregistered element */
-      free (q);
-
-      /*stop looping */
-      break;
-    }
+  /*Unlock the node before dropping the reference, after which it may
+     be reclaimed */
+  mutex_unlock (&node->lock);
 
   /*Remove a reference from the supplied lnode */
   lnode_ref_remove (node);
-
-
-  /*Unlock the node */
-  mutex_unlock (&node->lock);
-
-  return;
 }				/*lnode_remove_proxy */
 
 /*---------------------------------------------------------------------------*/
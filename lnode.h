@@ -30,11 +30,48 @@
 #include <error.h>
 #include <hurd/netfs.h>
 /*---------------------------------------------------------------------------*/
+#include "slab.h"
+#include "intern.h"
+/*---------------------------------------------------------------------------*/
 
 /*---------------------------------------------------------------------------*/
 /*--------Macros-------------------------------------------------------------*/
 /*The possible flags in an lnode*/
 #define FLAG_LNODE_DIR	0x00000001	/*the lnode is a directory */
+#define FLAG_LNODE_SNAPSHOT	0x00000002	/*the lnode has been restored
+						   from a snapshot and not
+						   looked up since */
+/*---------------------------------------------------------------------------*/
+/*The initial number of buckets in the hash index of a directory lnode
+  (must be a power of two)*/
+#define LNODE_HTABLE_SIZE_INIT 16
+/*---------------------------------------------------------------------------*/
+/*The hash index of a directory is grown when the average number of
+  entries per bucket exceeds this value*/
+#define LNODE_HTABLE_LOAD_MAX 2
+/*---------------------------------------------------------------------------*/
+/*The value of the reference counter of an lnode which has been
+  claimed by the reclaimer; such an lnode cannot be referenced again*/
+#define LNODE_REFS_DEAD (-1)
+/*---------------------------------------------------------------------------*/
+/*The default maximal number of proxy nodes of a single lnode*/
+#define LNODE_PROXIES_MAX 64
+/*---------------------------------------------------------------------------*/
+/*The interval (in milliseconds) between two rounds of reclamation of
+  unreferenced lnodes*/
+#define LNODE_RECLAIM_INTERVAL 100
+/*---------------------------------------------------------------------------*/
+/*The default time (in milliseconds) for which a failed lookup in a
+  directory is remembered*/
+#define LNODE_NEGATIVE_TTL 2000
+/*---------------------------------------------------------------------------*/
+/*The default maximal number of failed lookups remembered in a single
+  directory*/
+#define LNODE_NEGATIVES_MAX 32
+/*---------------------------------------------------------------------------*/
+/*The default amount of memory (in bytes) the lnode tree may occupy
+  before idle lnodes start being pruned*/
+#define LNODE_MEMORY_MAX (4 * 1024 * 1024)
 /*---------------------------------------------------------------------------*/
 
 /*---------------------------------------------------------------------------*/
@@ -42,43 +79,95 @@
 /*A candy synonym for the fundamental libnetfs node*/
 typedef struct node node_t;
 /*---------------------------------------------------------------------------*/
-/*A list of lnodes*/
-struct node_element
+/*A name which is known not to exist in a directory (a negative entry)*/
+struct lnode_negative
 {
-  /*the node associated with the current entry */
-  node_t *node;
+  /*the next negative entry of the same directory */
+  struct lnode_negative *next;
 
-  /*the next element in the list */
-  struct node_element *next;
-};				/*struct node_element */
+  /*the hash and the length of the name */
+  unsigned long name_hash;
+  size_t name_len;
+
+  /*the moment (in milliseconds) after which the entry is not trusted */
+  unsigned long expires;
+
+  /*the name itself */
+  char name[0];
+};				/*struct lnode_negative */
 /*---------------------------------------------------------------------------*/
-typedef struct node_element *node_list_t;
+typedef struct lnode_negative lnode_negative_t;
+/*---------------------------------------------------------------------------*/
+/*The hash index of the entries of a directory lnode. The index is
+  replaced as a whole when it grows, so that lock-free readers always
+  see a size matching the buckets*/
+struct lnode_htable
+{
+  /*the number of buckets; always a power of two */
+  size_t size;
+
+  /*the next index waiting to be freed by the reclaimer */
+  struct lnode_htable *retired_next;
+
+  /*the buckets */
+  struct lnode *volatile buckets[0];
+};				/*struct lnode_htable */
+/*---------------------------------------------------------------------------*/
+typedef struct lnode_htable lnode_htable_t;
 /*---------------------------------------------------------------------------*/
 /*The light node*/
 struct lnode
 {
-  /*the name of the lnode */
-  char *name;
+  /*the interned name of the lnode, which also keeps its length and
+     hash; equal names of different lnodes are the same object */
+  intern_name_t *iname;
 
-  /*the length of the name; `name` does not change, and this value is used
-     quite often, therefore calculate it just once */
-  size_t name_len;
+  /*the string of `iname` */
+  char *name;
 
-  /*the full path to the lnode */
+  /*the full path to the lnode; built from the path of `dir` the first
+     time it is needed and never changed afterwards (see
+     lnode_path_construct) */
   char *path;
 
+  /*the length of `path` */
+  size_t path_len;
+
   /*the associated flags */
   int flags;
 
-  /*the number of references to this lnode */
-  int references;
+  /*the generation of the file, as last reported by io_stat */
+  unsigned int stat_gen;
+
+  /*the number of references to this lnode; modified atomically only */
+  volatile int references;
+
+  /*nonzero while this lnode is queued for the reclaimer */
+  volatile int retired;
+
+  /*the next lnode in the queue of the reclaimer */
+  struct lnode *reclaim_next;
+
+  /*the neighbours in the list of idle lnodes, which are kept until the
+     tree grows too large, and whether the lnode is in that list;
+     protected by the lock of the reclaimer */
+  struct lnode *idle_next, *idle_prev;
+  int idle;
+
+  /*the number of bytes occupied by this lnode and the data it owns
+     (except the name, which is shared) */
+  volatile long memory;
 
   /*the reference to the real netfs node */
   node_t *node;
 
-  /*the references to the proxy nodes of this lnode;
-     lnodes do not hold references to */
-  node_list_t proxies;
+  /*the list of the proxy nodes of this lnode, linked through the
+     `proxy_next` fields of their netnodes; lnodes do not hold
+     references to them */
+  node_t *proxies;
+
+  /*the number of nodes in `proxies` */
+  int proxies_count;
 
   /*the next lnode and the pointer to this lnode from the previous one */
   struct lnode *next, **prevp;
@@ -89,6 +178,27 @@ struct lnode
   /*the beginning of the list of entries contained in this lnode (directory) */
   struct lnode *entries;
 
+  /*the hash index of `entries`, keyed on the names of the entries;
+     read without locks, see lnode_get */
+  lnode_htable_t *volatile htable;
+
+  /*the number of entries contained in this lnode (directory) */
+  size_t entries_count;
+
+  /*the next lnode in the same bucket of the hash index of `dir` */
+  struct lnode *hnext;
+
+  /*the names recently found not to exist in this lnode (directory),
+     the most recent first */
+  lnode_negative_t *negatives;
+
+  /*the number of entries in `negatives` */
+  size_t negatives_count;
+
+  /*the modification time of the directory when `negatives` were
+     recorded; the entries are dropped when it changes */
+  time_t negatives_mtime;
+
   /*the lock, protecting this lnode */
   struct mutex lock;
 };				/*struct lnode */
@@ -96,15 +206,73 @@ struct lnode
 typedef struct lnode lnode_t;
 /*---------------------------------------------------------------------------*/
 
+/*---------------------------------------------------------------------------*/
+/*--------Global Variables---------------------------------------------------*/
+/*The allocator of lnodes*/
+extern slab_t lnode_slab;
+/*---------------------------------------------------------------------------*/
+/*The maximal number of proxy nodes of a single lnode (0 means no
+  limit)*/
+extern int lnode_proxies_max;
+/*---------------------------------------------------------------------------*/
+/*The time (in milliseconds) for which a failed lookup is remembered
+  (0 disables the negative entries)*/
+extern int lnode_negative_ttl;
+/*---------------------------------------------------------------------------*/
+/*The maximal number of negative entries of a single directory*/
+extern int lnode_negatives_max;
+/*---------------------------------------------------------------------------*/
+/*The amount of memory (in bytes) the lnode tree may occupy before
+  idle lnodes start being pruned*/
+extern long lnode_memory_max;
+/*---------------------------------------------------------------------------*/
+/*The number of lookups answered from and missed in the negative entries*/
+extern volatile unsigned long lnode_negative_hits;
+extern volatile unsigned long lnode_negative_misses;
+/*---------------------------------------------------------------------------*/
+
 /*----------------------------------------------------------------------------*/
 /*--------Functions----------------------------------------------------------*/
-/*Adds a reference to the `lnode` (which must be locked)*/
+/*Adds a reference to the `lnode`. The caller must already hold a
+  reference to `node` (possibly through a node or an entry of it)*/
 void lnode_ref_add (lnode_t * node);
 /*---------------------------------------------------------------------------*/
-/*Removes a reference from `node` (which must be locked). If that was
-  the last reference, destroy the node*/
+/*Removes a reference from `node`. If that was the last reference,
+  queue the node for the reclaimer, which will keep it idle and
+  uninstall and destroy it when the tree grows too large, unless it is
+  referenced again meanwhile. Does not lock or unlock anything*/
 void lnode_ref_remove (lnode_t * node);
 /*---------------------------------------------------------------------------*/
+/*Marks the beginning of a section in which the current thread may
+  access lnodes it holds no references to; returns the value to be
+  passed to lnode_epoch_exit*/
+int lnode_epoch_enter (void);
+/*---------------------------------------------------------------------------*/
+/*Marks the end of the section started by lnode_epoch_enter*/
+void lnode_epoch_exit (int epoch);
+/*---------------------------------------------------------------------------*/
+/*Moves the lnodes which have been released since the previous call
+  and have not been referenced again to the list of idle lnodes, and
+  uninstalls and destroys the least recently used idle lnodes while
+  the tree occupies more than `lnode_memory_max` bytes*/
+void lnode_reclaim (void);
+/*---------------------------------------------------------------------------*/
+/*Does the work of lnode_reclaim, pruning the idle lnodes while the tree
+  occupies more than `limit` bytes*/
+void lnode_reclaim_to (long limit);
+/*---------------------------------------------------------------------------*/
+/*Returns the number of bytes occupied by the lnode tree*/
+long lnode_memory_used (void);
+/*---------------------------------------------------------------------------*/
+/*Starts the thread which periodically calls lnode_reclaim*/
+void lnode_reclaim_init (void);
+/*---------------------------------------------------------------------------*/
+/*Marks `node` as a directory or as a file*/
+void lnode_set_dir (lnode_t * node, int isdir);
+/*---------------------------------------------------------------------------*/
+/*Prints the counters of the lnode tree to `f`*/
+void lnode_report (FILE * f);
+/*---------------------------------------------------------------------------*/
 /*Creates a new lnode with `name`; the new node is locked and contains
   a single reference*/
 error_t lnode_create (char *name, lnode_t ** node);
@@ -114,10 +282,19 @@ void lnode_destroy (lnode_t * node);
 /*---------------------------------------------------------------------------*/
 /*Constructs the full path for the given lnode and stores the result
   both in the parameter and inside the lnode (the same string,
-  actually)*/
+  actually). The path is built only once, from the cached path of the
+  parent, and may be read without locking once it is set*/
 error_t lnode_path_construct (lnode_t * node, char **path);
 /*---------------------------------------------------------------------------*/
-/*Gets a light node by its name, locks it and increments its refcount*/
+/*Checks whether the entry `name` of `dir` was a directory when it was
+  last looked up (or when the snapshot it was restored from was made);
+  nothing is locked, so the answer is only a hint*/
+int lnode_is_dir (lnode_t * dir, char *name);
+/*---------------------------------------------------------------------------*/
+/*Gets a light node by its name, locks it and increments its refcount.
+  `dir` need not be locked: the entries are looked up without locks,
+  so an entry installed concurrently may be missed; callers wishing to
+  install `name` must retry with `dir` locked*/
 error_t lnode_get (lnode_t * dir,	/*search here */
 		   char *name,	        /*search for this name */
 		   lnode_t ** node	/*put the result here */
@@ -125,13 +302,27 @@ error_t lnode_get (lnode_t * dir,	/*search here */
 /*---------------------------------------------------------------------------*/
 /*Install the lnode into the lnode tree: add a reference to `dir`
   (which must be locked)*/
-void lnode_install (lnode_t * dir,	/*install here */
-		    lnode_t * node	/*install this */
-		    );
+error_t lnode_install (lnode_t * dir,	/*install here */
+		       lnode_t * node	/*install this */
+		       );
 /*---------------------------------------------------------------------------*/
-/*Unistall the node from the node tree; remove a reference from the lnode*/
+/*Unistall the node from the node tree; the directory containing
+  `node` must be locked. The reference held by `node` to the directory
+  is not removed*/
 void lnode_uninstall (lnode_t * node);
 /*---------------------------------------------------------------------------*/
+/*Checks whether `name` is known not to exist in `dir` (which must be
+  locked and whose modification time is `mtime`); returns nonzero if
+  so. Stale entries are dropped on the way*/
+int lnode_negative_lookup (lnode_t * dir, const char * name, time_t mtime);
+/*---------------------------------------------------------------------------*/
+/*Remembers that `name` does not exist in `dir` (which must be locked
+  and whose modification time is `mtime`)*/
+void lnode_negative_add (lnode_t * dir, const char * name, time_t mtime);
+/*---------------------------------------------------------------------------*/
+/*Drops all negative entries of `dir` (which must be locked)*/
+void lnode_negative_flush (lnode_t * dir);
+/*---------------------------------------------------------------------------*/
 /*Makes the specified lnode aware of another proxy. Both `node` and
   `proxy` must be locked*/
 error_t lnode_add_proxy (lnode_t * node, node_t * proxy);
@@ -0,0 +1,261 @@
+/*---------------------------------------------------------------------------*/
+/*memory.c*/
+/*---------------------------------------------------------------------------*/
+/*The governor of the memory occupied by the caches.*/
+/*---------------------------------------------------------------------------*/
+/*Copyright (C) 2009 Free Software Foundation, Inc.
+
+  This program is free software; you can redistribute it and/or
+  modify it under the terms of the GNU General Public License as
+  published by the Free Software Foundation; either version 2 of the
+  License, or * (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+  General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307
+  USA.*/
+/*---------------------------------------------------------------------------*/
+
+/*---------------------------------------------------------------------------*/
+#define _GNU_SOURCE 1
+/*---------------------------------------------------------------------------*/
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <cthreads.h>
+/*---------------------------------------------------------------------------*/
+#include "memory.h"
+#include "debug.h"
+#include "lnode.h"
+#include "node.h"
+#include "ncache.h"
+/*---------------------------------------------------------------------------*/
+
+/*---------------------------------------------------------------------------*/
+/*--------Macros-------------------------------------------------------------*/
+/*The number of bytes occupied by a node pinned by the node cache*/
+#define MEMORY_NODE_SIZE (sizeof (struct node) + sizeof (netnode_t))
+/*---------------------------------------------------------------------------*/
+
+/*---------------------------------------------------------------------------*/
+/*--------Global Variables---------------------------------------------------*/
+/*The number of bytes the caches may occupy before memory starts being
+  released (0 means no limit)*/
+long memory_limit;
+/*---------------------------------------------------------------------------*/
+/*The number of times memory has been released and the number of bytes
+  released in total*/
+unsigned long memory_releases, memory_released;
+/*---------------------------------------------------------------------------*/
+/*The file whose modification signals memory pressure (NULL if none),
+  the number of times it has been set and the lock protecting both; the
+  governor only ever stats a copy of the path, so the option handler
+  may replace it at any time*/
+static char *memory_pressure_file;
+static unsigned long memory_pressure_gen;
+static struct mutex memory_pressure_lock = MUTEX_INITIALIZER;
+/*---------------------------------------------------------------------------*/
+/*The setting of the file watched at the last check and its
+  modification time then (0 if the file did not exist)*/
+static unsigned long memory_pressure_watched;
+static time_t memory_pressure_mtime;
+/*---------------------------------------------------------------------------*/
+/*The lock serializing the releases of memory*/
+static struct mutex memory_lock = MUTEX_INITIALIZER;
+/*---------------------------------------------------------------------------*/
+
+/*---------------------------------------------------------------------------*/
+/*--------Functions----------------------------------------------------------*/
+/*Returns the number of bytes occupied by the caches: the nodes pinned
+  by the node cache, the lnode tree with its names and the cached
+  listings of directories*/
+long memory_used (void)
+{
+  return ncache_count () * MEMORY_NODE_SIZE + lnode_memory_used ()
+    + node_listing_memory;
+}				/*memory_used */
+
+/*---------------------------------------------------------------------------*/
+/*Releases memory until the caches occupy at most `target` bytes, giving
+  up the cached listings first, then the nodes in the node cache and
+  finally the lnodes which are not in use; memory in use cannot be
+  released, so the target may be missed*/
+void memory_release (long target)
+{
+  /*The memory occupied before and the amount still to release */
+  long used, excess;
+
+  /*The number of nodes the node cache must give up */
+  int nodes;
+
+  mutex_lock (&memory_lock);
+
+  used = memory_used ();
+  excess = used - target;
+
+  /*The listings can always be read again, so they go first */
+  if (excess > 0)
+    {
+      node_listing_trim ((node_listing_memory > excess)
+			 ? (node_listing_memory - excess) : (0));
+      excess = memory_used () - target;
+    }
+
+  /*The nodes in the node cache only save lookups; the lnodes they pin
+     become idle once they are evicted */
+  if (excess > 0)
+    {
+      nodes = (excess + MEMORY_NODE_SIZE - 1) / MEMORY_NODE_SIZE;
+      ncache_trim ((ncache_count () > nodes) ? (ncache_count () - nodes) : 0);
+      excess = memory_used () - target;
+    }
+
+  /*The idle lnodes keep the names looked up, so they go last */
+  if (excess > 0)
+    lnode_reclaim_to (lnode_memory_used () - excess);
+
+  /*Account for the memory actually released */
+  excess = used - memory_used ();
+  if (excess > 0)
+    {
+      ++memory_releases;
+      memory_released += excess;
+    }
+
+  mutex_unlock (&memory_lock);
+}				/*memory_release */
+
+/*---------------------------------------------------------------------------*/
+/*Sets the file whose modification signals memory pressure (NULL to
+  watch none)*/
+error_t memory_pressure_file_set (const char *path)
+{
+  /*The copy of `path` and the path it replaces */
+  char *file = NULL, *old;
+
+  if (path)
+    {
+      file = strdup (path);
+      if (!file)
+	return ENOMEM;
+    }
+
+  mutex_lock (&memory_pressure_lock);
+  old = memory_pressure_file;
+  memory_pressure_file = file;
+  ++memory_pressure_gen;
+  mutex_unlock (&memory_pressure_lock);
+
+  free (old);
+  return 0;
+}				/*memory_pressure_file_set */
+
+/*---------------------------------------------------------------------------*/
+/*Returns a copy of the path of the file whose modification signals
+  memory pressure, to be freed by the caller (NULL if none is watched or
+  the copy could not be made)*/
+char *memory_pressure_file_get (void)
+{
+  /*The copy of the path */
+  char *file = NULL;
+
+  mutex_lock (&memory_pressure_lock);
+  if (memory_pressure_file)
+    file = strdup (memory_pressure_file);
+  mutex_unlock (&memory_pressure_lock);
+
+  return file;
+}				/*memory_pressure_file_get */
+
+/*---------------------------------------------------------------------------*/
+/*Checks whether the file set by memory_pressure_file_set has been
+  touched since the previous call*/
+static int memory_pressure_signalled (void)
+{
+  /*The stat information of the file */
+  struct stat st;
+
+  /*The modification time seen at this check */
+  time_t mtime;
+
+  /*The file to check and the setting it belongs to */
+  char *file;
+  unsigned long gen;
+
+  mutex_lock (&memory_pressure_lock);
+  file = memory_pressure_file ? strdup (memory_pressure_file) : NULL;
+  gen = memory_pressure_gen;
+  mutex_unlock (&memory_pressure_lock);
+
+  if (!file)
+    return 0;
+
+  mtime = (stat (file, &st) == 0) ? (st.st_mtime) : (0);
+  free (file);
+
+  /*A file which has just been given to watch signals nothing yet */
+  if (gen != memory_pressure_watched)
+    {
+      memory_pressure_watched = gen;
+      memory_pressure_mtime = mtime;
+      return 0;
+    }
+
+  if (mtime == memory_pressure_mtime)
+    return 0;
+
+  /*A file which disappeared signals nothing */
+  memory_pressure_mtime = mtime;
+  return mtime != 0;
+}				/*memory_pressure_signalled */
+
+/*---------------------------------------------------------------------------*/
+/*The body of the thread which watches the memory occupied by the
+  caches*/
+static void *memory_governor_thread (void *arg)
+{
+  for (;;)
+    {
+      usleep (MEMORY_CHECK_INTERVAL * 1000);
+
+      /*An external signal asks for everything that can be spared */
+      if (memory_pressure_signalled ())
+	{
+	  LOG_MSG ("memory_governor_thread: Memory pressure signalled.");
+	  memory_release (0);
+	}
+      /*Otherwise keep within the soft limit, with some slack */
+      else if ((memory_limit > 0) && (memory_used () > memory_limit))
+	memory_release (memory_limit - memory_limit / MEMORY_HYSTERESIS);
+    }
+
+  return NULL;
+}				/*memory_governor_thread */
+
+/*---------------------------------------------------------------------------*/
+/*Starts the thread which releases memory when the caches exceed
+  `memory_limit` or when the file set by memory_pressure_file_set is
+  touched*/
+void memory_governor_init (void)
+{
+  cthread_detach (cthread_fork ((cthread_fn_t) memory_governor_thread, 0));
+}				/*memory_governor_init */
+
+/*---------------------------------------------------------------------------*/
+/*Prints the memory occupied by the caches to `f`*/
+void memory_report (FILE * f)
+{
+  fprintf (f, "memory: %ld bytes (%ld in %d cached nodes, %ld in lnodes, "
+	   "%lu in listings), limit %ld, %lu bytes released %lu times\n",
+	   memory_used (), (long) (ncache_count () * MEMORY_NODE_SIZE),
+	   ncache_count (), lnode_memory_used (), node_listing_memory,
+	   memory_limit, memory_released, memory_releases);
+}				/*memory_report */
+
+/*---------------------------------------------------------------------------*/
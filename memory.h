@@ -0,0 +1,85 @@
+/*---------------------------------------------------------------------------*/
+/*memory.h*/
+/*---------------------------------------------------------------------------*/
+/*The governor of the memory occupied by the caches.*/
+/*---------------------------------------------------------------------------*/
+/*Copyright (C) 2009 Free Software Foundation, Inc.
+
+  This program is free software; you can redistribute it and/or
+  modify it under the terms of the GNU General Public License as
+  published by the Free Software Foundation; either version 2 of the
+  License, or * (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+  General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307
+  USA.*/
+/*---------------------------------------------------------------------------*/
+#ifndef __MEMORY_H__
+#define __MEMORY_H__
+
+/*---------------------------------------------------------------------------*/
+#include <stdio.h>
+#include <errno.h>
+/*---------------------------------------------------------------------------*/
+
+/*---------------------------------------------------------------------------*/
+/*--------Macros-------------------------------------------------------------*/
+/*The interval in milliseconds between two checks of the memory
+  occupied by the caches*/
+#define MEMORY_CHECK_INTERVAL 1000
+/*---------------------------------------------------------------------------*/
+/*The part of the soft limit released in addition to the excess, so that
+  the caches are not shrunk again right after they grow by a few bytes
+  (the caches are brought down to limit - limit / MEMORY_HYSTERESIS)*/
+#define MEMORY_HYSTERESIS 8
+/*---------------------------------------------------------------------------*/
+
+/*---------------------------------------------------------------------------*/
+/*--------Global Variables---------------------------------------------------*/
+/*The number of bytes the caches may occupy before memory starts being
+  released (0 means no limit)*/
+extern long memory_limit;
+/*---------------------------------------------------------------------------*/
+/*The number of times memory has been released and the number of bytes
+  released in total*/
+extern unsigned long memory_releases, memory_released;
+/*---------------------------------------------------------------------------*/
+
+/*---------------------------------------------------------------------------*/
+/*--------Functions----------------------------------------------------------*/
+/*Returns the number of bytes occupied by the caches: the nodes pinned
+  by the node cache, the lnode tree with its names and the cached
+  listings of directories*/
+long memory_used (void);
+/*---------------------------------------------------------------------------*/
+/*Releases memory until the caches occupy at most `target` bytes, giving
+  up the cached listings first, then the nodes in the node cache and
+  finally the lnodes which are not in use; memory in use cannot be
+  released, so the target may be missed*/
+void memory_release (long target);
+/*---------------------------------------------------------------------------*/
+/*Sets the file whose modification signals memory pressure: every time
+  it is touched, all the memory the caches can spare is released (NULL
+  to watch none)*/
+error_t memory_pressure_file_set (const char *path);
+/*---------------------------------------------------------------------------*/
+/*Returns a copy of the path of the file whose modification signals
+  memory pressure, to be freed by the caller (NULL if none is watched or
+  the copy could not be made)*/
+char *memory_pressure_file_get (void);
+/*---------------------------------------------------------------------------*/
+/*Starts the thread which releases memory when the caches exceed
+  `memory_limit` or when the file set by memory_pressure_file_set is
+  touched*/
+void memory_governor_init (void);
+/*---------------------------------------------------------------------------*/
+/*Prints the memory occupied by the caches to `f`*/
+void memory_report (FILE * f);
+/*---------------------------------------------------------------------------*/
+#endif /*__MEMORY_H__*/
@@ -27,39 +27,72 @@
 /*---------------------------------------------------------------------------*/
 #define _GNU_SOURCE 1
 /*---------------------------------------------------------------------------*/
+#include <string.h>
+/*---------------------------------------------------------------------------*/
 #include "ncache.h"
 /*---------------------------------------------------------------------------*/
 
 /*---------------------------------------------------------------------------*/
 /*--------Global Variables---------------------------------------------------*/
-/*The global cache chain*/
-ncache_t ncache;
+/*The shards of the cache*/
+ncache_t ncache[NCACHE_SHARDS];
 /*---------------------------------------------------------------------------*/
 /*Cache size (may be overwritten by the user)*/
-/*int ncache_size = NCACHE_SIZE;*/
-/*Our cache is not really a cache now (actually, it has never been
-  one). Its main task now will be to maintain additional references to
-  shadow nodes, which are still in use by some clients and which could
-  possibly go away if nobody maintained references to them
-  explicitly.*/
+int ncache_size = NCACHE_SIZE;
+/*The cache keeps the most recently used nodes alive. Besides that,
+  it maintains additional references to shadow nodes, which are still
+  in use by some clients and which could possibly go away if nobody
+  maintained references to them explicitly; such nodes are never
+  pushed out of the cache.*/
+/*---------------------------------------------------------------------------*/
+/*The replacement policy of the cache (set in ncache_policy_set)*/
+const ncache_policy_t *ncache_policy;
+/*---------------------------------------------------------------------------*/
+/*Set once the shards of the cache have been initialized*/
+static int ncache_initialized;
+/*---------------------------------------------------------------------------*/
+/*The index of `ncache_policy` in the table of policies, which selects
+  the counters the hits and misses are added to*/
+static int ncache_policy_index;
 /*---------------------------------------------------------------------------*/
 
 /*---------------------------------------------------------------------------*/
 /*--------Functions----------------------------------------------------------*/
 /*Initializes the node cache*/
-void ncache_init (void)
+void ncache_init (int size_max)
 {
-  /*Reset the LRU and MRU ends of the list */
-  ncache.mru = ncache.lru = NULL;
+  /*The shard being initialized */
+  int i;
 
-  /*Set the maximal size according to the parameter */
-  /*ncache.size_max = size_max; */
+  /*Fall back to the default policy if none has been chosen */
+  if (!ncache_policy)
+    ncache_policy_set (NCACHE_POLICY);
 
-  /*The cache is empty so far; remark that */
-  ncache.size_current = 0;
+  for (i = 0; i < NCACHE_SHARDS; ++i)
+    {
+      /*Reset the LRU and MRU ends of the queues */
+      memset (ncache[i].queues, 0, sizeof (ncache[i].queues));
+
+      /*Give every shard its part of the maximal size */
+      ncache[i].size_max = (size_max + NCACHE_SHARDS - 1) / NCACHE_SHARDS;
+
+      /*The cache is empty so far; remark that */
+      ncache[i].size_current = 0;
+      memset ((void *) ncache[i].hits, 0, sizeof (ncache[i].hits));
+      memset ((void *) ncache[i].misses, 0, sizeof (ncache[i].misses));
+      memset ((void *) ncache[i].hits_dropped, 0,
+	      sizeof (ncache[i].hits_dropped));
+
+      /*No hits have been buffered yet */
+      memset ((void *) ncache[i].hit_buffer, 0,
+	      sizeof (ncache[i].hit_buffer));
+      ncache[i].hit_buffer_tail = 0;
+
+      /*Init the lock */
+      mutex_init (&ncache[i].lock);
+    }
 
-  /*Init the lock */
-  mutex_init (&ncache.lock);
+  ncache_initialized = 1;
 }				/*ncache_init */
 
 /*---------------------------------------------------------------------------*/
@@ -71,16 +104,23 @@ error_t ncache_node_lookup (lnode_t * lnode,	/*search for this */
 {
   error_t err = 0;
 
-  /*Obtain the pointer to the node corresponding to `lnode` */
-  node_t *n = lnode->node;
-
-  /*If a node has already been created for the given lnode */
-  if (n != NULL)
-    {
-      /*count a new reference to 'n' */
-      netfs_nref (n);
-    }
+  /*The node corresponding to `lnode` */
+  node_t *n;
+
+  /*Obtain the node and count a new reference to it in one step:
+     node_destroy detaches the node from `lnode` under the same lock,
+     right after the last reference has gone, so a node which is being
+     destroyed is never found here */
+  spin_lock (&netfs_node_refcnt_lock);
+  n = lnode->node;
+  if (n && (n->references > 0))
+    ++n->references;
   else
+    n = NULL;
+  spin_unlock (&netfs_node_refcnt_lock);
+
+  /*If no node is alive for the given lnode */
+  if (n == NULL)
     {
       /*create a new node for the given lnode and store the result in `n` */
       err = node_create (lnode, &n);
@@ -100,17 +140,50 @@ error_t ncache_node_lookup (lnode_t * lnode,	/*search for this */
   return err;
 }				/*ncache_node_lookup */
 
+/*---------------------------------------------------------------------------*/
+/*Puts `node` at the MRU end of the queue `q` of `shard`*/
+static void ncache_queue_push (ncache_t * shard, int q, node_t * node)
+{
+  /*The queue to put the node in */
+  struct ncache_queue *queue = &shard->queues[q];
+
+  /*put the node at the MRU end of the queue */
+  node->nn->ncache_next = queue->mru;
+  node->nn->ncache_prev = NULL;
+  node->nn->ncache_queue = q;
+
+  /*setup the pointer in the old MRU end, if it exists */
+  if (queue->mru != NULL)
+    queue->mru->nn->ncache_prev = node;
+
+  /*setup the LRU end of the queue, if it did not exist previously */
+  if (queue->lru == NULL)
+    queue->lru = node;
+
+  /*shift the MRU end to the new node */
+  queue->mru = node;
+  node->nn->ncache_resident = 1;
+
+  /*count the addition */
+  ++queue->size;
+  ++shard->size_current;
+}				/*ncache_queue_push */
+
 /*---------------------------------------------------------------------------*/
 /*Removes the given node from the cache. Does not release the
   reference held by the cache (for some further finalization actions
-  on the node)*/
-/*Nodes will NOT be removed from the cache automatically*/
+  on the node). The shard of the cache containing `node` must be
+  locked*/
 void ncache_node_remove (node_t * node)
 {
   /*Obtain the pointer to the netnode (this contains the information
      specific of us) */
   struct netnode *nn = node->nn;
 
+  /*The shard and the queue containing the node */
+  ncache_t *shard = NCACHE_SHARD (node);
+  struct ncache_queue *queue = &shard->queues[nn->ncache_queue];
+
   /*If there exists a successor of this node in the cache chain */
   if (nn->ncache_next)
     /*remove the reference in the successor */
@@ -121,19 +194,21 @@ void ncache_node_remove (node_t * node)
     nn->ncache_prev->nn->ncache_next = nn->ncache_next;
 
   /*If the node was located at the MRU end of the list */
-  if (ncache.mru == node)
+  if (queue->mru == node)
     /*shift the MRU end to the next node */
-    ncache.mru = nn->ncache_next;
+    queue->mru = nn->ncache_next;
   /*If the node was located at the LRU end of the list */
-  if (ncache.lru == node)
+  if (queue->lru == node)
     /*shift the LRU end to the previous node */
-    ncache.lru = nn->ncache_prev;
+    queue->lru = nn->ncache_prev;
 
   /*Invalidate the references inside the node */
   nn->ncache_next = nn->ncache_prev = NULL;
+  nn->ncache_referenced = nn->ncache_resident = 0;
 
   /*Count the removal of a node */
-  --ncache.size_current;
+  --queue->size;
+  --shard->size_current;
 }				/*ncache_node_remove */
 
 /*---------------------------------------------------------------------------*/
@@ -145,78 +220,537 @@ ncache_reset (void)
   /*The node being currently removed from the cache */
   node_t *node;
 
-  /*Acquire a lock on the cache */
-  mutex_lock (&ncache.lock);
+  /*The shard and the queue being emptied */
+  int i, q;
+
+  for (i = 0; i < NCACHE_SHARDS; ++i)
+    {
+      /*Acquire a lock on the shard */
+      mutex_lock (&ncache[i].lock);
 
-  /*Release the whole cache chain */
-  for (node = ncache.mru; node != NULL;
-       ncache_node_remove (node), node = ncache.mru);
+      /*Release the whole cache chain */
+      for (q = 0; q < NCACHE_QUEUES; ++q)
+	for (node = ncache[i].queues[q].mru; node != NULL;
+	     ncache_node_remove (node), node = ncache[i].queues[q].mru);
 
-  /*Release the lock */
-  mutex_unlock (&ncache.lock);
+      /*Release the lock */
+      mutex_unlock (&ncache[i].lock);
+    }
 }				/*ncache_reset */
 
 /*---------------------------------------------------------------------------*/
-/*Adds the given node to the cache*/
-void ncache_node_add (node_t * node)
+/*Checks whether `node` is in the cache chain; the answer is only
+  reliable with the shard of the cache containing `node` locked*/
+static int ncache_contains (node_t * node)
+{
+  /*The flag is maintained by ncache_queue_push and ncache_node_remove */
+  return node->nn->ncache_resident;
+}				/*ncache_contains */
+
+/*---------------------------------------------------------------------------*/
+/*Walks the queue `q` of `shard` from the LRU end and returns the first
+  node which may be pushed out of the cache, or NULL if there is none.
+  If `second_chance` is set, the nodes used since the previous walk
+  are moved to the MRU end instead (the CLOCK algorithm)*/
+static node_t *ncache_queue_victim (ncache_t * shard, int q,
+				    int second_chance)
 {
-  /*Acquire a lock on the cache */
-  mutex_lock (&ncache.lock);
+  /*The node being examined and the one used less recently */
+  node_t *node, *prev;
+
+  /*The number of nodes examined; every node may be visited twice,
+     once to clear its reference bit and once to push it out */
+  int scanned, scanned_max = 2 * shard->queues[q].size;
 
-  /*If there already are some nodes in the cache already */
-  if (ncache.size_current > 0)
+  for (node = shard->queues[q].lru, scanned = 0;
+       node && (scanned < scanned_max); node = prev, ++scanned)
     {
-      /*If the node to be added is not at the MRU end already */
-      if (ncache.mru != node)
+      prev = node->nn->ncache_prev;
+
+      /*Shadow nodes are kept, see the comment at the top of the file */
+      if (node->nn->type == NODE_TYPE_SHADOW)
+	continue;
+
+      /*Give the nodes used recently another round */
+      if (second_chance && node->nn->ncache_referenced)
 	{
-	  /*If the node is correctly integrated in the cache */
-	  if ((node->nn->ncache_next != NULL)
-	      && (node->nn->ncache_prev != NULL))
-	    /*remove the old entry */
-	    ncache_node_remove (node);
-	  else
-	    /*add a new reference to the node */
-	    netfs_nref (node);
-
-	  /*put the node at the MRU end of the cache chain */
-	  node->nn->ncache_next = ncache.mru;
-	  node->nn->ncache_prev = NULL;
-
-	  /*setup the pointer in the old MRU end, if it exists */
-	  if (ncache.mru != NULL)
-	    ncache.mru->nn->ncache_prev = node;
-
-	  /*setup the LRU end of the cache chain, if it did not exist
-	    previously */
-	  if (ncache.lru == NULL)
-	    ncache.lru = node;
-
-	  /*shift the MRU end to the new node */
-	  ncache.mru = node;
-
-	  /*count the addition */
-	  ++ncache.size_current;
+	  ncache_node_remove (node);
+	  ncache_queue_push (shard, q, node);
+
+	  /*wrap around when the whole queue has been walked */
+	  if (!prev)
+	    prev = shard->queues[q].lru;
+
+	  continue;
 	}
+
+      return node;
+    }
+
+  return NULL;
+}				/*ncache_queue_victim */
+
+/*---------------------------------------------------------------------------*/
+/*Puts a new node at the MRU end of the only queue (LRU and CLOCK)*/
+static void ncache_insert_probation (ncache_t * shard, node_t * node)
+{
+  ncache_queue_push (shard, NCACHE_QUEUE_PROBATION, node);
+}				/*ncache_insert_probation */
+
+/*---------------------------------------------------------------------------*/
+/*Moves a used node to the MRU end of its queue (LRU)*/
+static void ncache_lru_hit (ncache_t * shard, node_t * node)
+{
+  /*The queue the node is kept in */
+  int q = node->nn->ncache_queue;
+
+  /*If the node is not at the MRU end already */
+  if (shard->queues[q].mru != node)
+    {
+      ncache_node_remove (node);
+      ncache_queue_push (shard, q, node);
+    }
+}				/*ncache_lru_hit */
+
+/*---------------------------------------------------------------------------*/
+/*Pushes out the least recently used node (LRU)*/
+static node_t *ncache_lru_victim (ncache_t * shard)
+{
+  return ncache_queue_victim (shard, NCACHE_QUEUE_PROBATION, 0);
+}				/*ncache_lru_victim */
+
+/*---------------------------------------------------------------------------*/
+/*Only marks a used node, instead of moving it (CLOCK)*/
+static void ncache_clock_hit (ncache_t * shard, node_t * node)
+{
+  node->nn->ncache_referenced = 1;
+}				/*ncache_clock_hit */
+
+/*---------------------------------------------------------------------------*/
+/*Pushes out the first node not used since the hand passed it (CLOCK)*/
+static node_t *ncache_clock_victim (ncache_t * shard)
+{
+  return ncache_queue_victim (shard, NCACHE_QUEUE_PROBATION, 1);
+}				/*ncache_clock_victim */
+
+/*---------------------------------------------------------------------------*/
+/*Moves a node used for a second time out of probation, or a node
+  already protected to the MRU end of the protected queue (2Q)*/
+static void ncache_2q_hit (ncache_t * shard, node_t * node)
+{
+  /*If the node is not at the MRU end of the protected queue already */
+  if (shard->queues[NCACHE_QUEUE_PROTECTED].mru != node)
+    {
+      ncache_node_remove (node);
+      ncache_queue_push (shard, NCACHE_QUEUE_PROTECTED, node);
+    }
+}				/*ncache_2q_hit */
+
+/*---------------------------------------------------------------------------*/
+/*Pushes out the nodes on probation while they occupy more than their
+  share of the shard, so that a scan through many files used only
+  once does not push out the nodes used repeatedly (2Q)*/
+static node_t *ncache_2q_victim (ncache_t * shard)
+{
+  /*The node to push out */
+  node_t *node = NULL;
+
+  /*The number of nodes the probation queue may keep */
+  int probation_max = shard->size_max / NCACHE_PROBATION_SHARE;
+
+  /*Prefer the nodes on probation if there are too many of them */
+  if (shard->queues[NCACHE_QUEUE_PROBATION].size > probation_max)
+    node = ncache_queue_victim (shard, NCACHE_QUEUE_PROBATION, 0);
+
+  /*Otherwise push out the least recently used protected node */
+  if (!node)
+    node = ncache_queue_victim (shard, NCACHE_QUEUE_PROTECTED, 0);
+
+  /*Resort to the nodes on probation if nothing else could be found */
+  if (!node)
+    node = ncache_queue_victim (shard, NCACHE_QUEUE_PROBATION, 0);
+
+  return node;
+}				/*ncache_2q_victim */
+
+/*---------------------------------------------------------------------------*/
+/*The available replacement policies*/
+static const ncache_policy_t ncache_policies[NCACHE_POLICIES + 1] = {
+  {"lru", ncache_insert_probation, ncache_lru_hit, ncache_lru_victim},
+  {"clock", ncache_insert_probation, ncache_clock_hit, ncache_clock_victim},
+  {"2q", ncache_insert_probation, ncache_2q_hit, ncache_2q_victim},
+  {NULL}
+};
+
+/*---------------------------------------------------------------------------*/
+/*Passes the buffered hits of `shard` to the replacement policy and
+  stores the nodes whose references the buffer held in `drained`;
+  returns their number. `shard` must be locked; the references must be
+  released after it is unlocked*/
+static int ncache_drain (ncache_t * shard, node_t ** drained)
+{
+  /*The node taken out of the buffer */
+  node_t *node;
+
+  /*The slot being examined and the number of nodes taken */
+  int i, count = 0;
+
+  for (i = 0; i < NCACHE_HIT_BUFFER; ++i)
+    {
+      /*Take the slot away from the threads filling the buffer */
+      node = __sync_lock_test_and_set (&shard->hit_buffer[i], NULL);
+      if (!node)
+	continue;
+
+      /*The node might have been pushed out since the hit */
+      if (ncache_contains (node))
+	ncache_policy->hit (shard, node);
+
+      drained[count++] = node;
+    }
+
+  return count;
+}				/*ncache_drain */
+
+/*---------------------------------------------------------------------------*/
+/*Releases the references to `count` nodes in `nodes`; the cache must
+  not be locked, since the last reference destroys the node*/
+static void ncache_release (node_t ** nodes, int count)
+{
+  int i;
+
+  for (i = 0; i < count; ++i)
+    netfs_nrele (nodes[i]);
+}				/*ncache_release */
+
+/*---------------------------------------------------------------------------*/
+/*Removes up to NCACHE_EVICT_BATCH nodes chosen by the replacement
+  policy from `shard` while it holds more than `limit` nodes and stores
+  them in `evicted`; returns the number of nodes removed. `shard` must
+  be locked*/
+static int ncache_evict (ncache_t * shard, int limit, node_t ** evicted)
+{
+  /*The node to push out */
+  node_t *node;
+
+  /*The number of nodes removed */
+  int count = 0;
+
+  while ((shard->size_current > limit)
+	 && (count < NCACHE_EVICT_BATCH)
+	 && ((node = ncache_policy->victim (shard)) != NULL))
+    {
+      ncache_node_remove (node);
+      evicted[count++] = node;
+    }
+
+  return count;
+}				/*ncache_evict */
+
+/*---------------------------------------------------------------------------*/
+/*Pushes the least valuable nodes out of `shard` while it holds more
+  than `limit` nodes*/
+static void ncache_shard_shrink (ncache_t * shard, int limit)
+{
+  /*The nodes pushed out of the cache and their number */
+  node_t *evicted[NCACHE_EVICT_BATCH];
+  int count;
+
+  /*The nodes of the buffered hits and their number */
+  node_t *drained[NCACHE_HIT_BUFFER];
+  int drained_count;
+
+  do
+    {
+      mutex_lock (&shard->lock);
+
+      /*Let the policy see the recent hits before it chooses */
+      drained_count = ncache_drain (shard, drained);
+
+      /*Remove a batch of nodes chosen by the policy */
+      count = ncache_evict (shard, limit, evicted);
+
+      mutex_unlock (&shard->lock);
+
+      /*Release the references held by the cache and the buffer */
+      ncache_release (drained, drained_count);
+      ncache_release (evicted, count);
+    }
+  while (count == NCACHE_EVICT_BATCH);
+}				/*ncache_shard_shrink */
+
+/*---------------------------------------------------------------------------*/
+/*Records a hit of the cached `node` in the buffer of `shard` without
+  locking it. The buffer is drained when it wraps around; if it is
+  full and the shard is busy, the hit is dropped*/
+static void ncache_hit_record (ncache_t * shard, node_t * node)
+{
+  /*The slot to store the hit in */
+  unsigned int slot;
+
+  /*The nodes of the buffered hits and their number */
+  node_t *drained[NCACHE_HIT_BUFFER];
+  int drained_count;
+
+  __sync_fetch_and_add (&shard->hits[ncache_policy_index], 1);
+
+  /*The buffer keeps the node alive until it is drained */
+  netfs_nref (node);
+
+  slot = __sync_fetch_and_add (&shard->hit_buffer_tail, 1)
+    & (NCACHE_HIT_BUFFER - 1);
+
+  /*If the slot is free and this was not the last one, we are done */
+  if (__sync_bool_compare_and_swap (&shard->hit_buffer[slot], NULL, node))
+    {
+      if (slot != NCACHE_HIT_BUFFER - 1)
+	return;
+
+      /*drain the buffer if it is not being used by somebody else */
+      if (!mutex_try_lock (&shard->lock))
+	return;
+
+      drained_count = ncache_drain (shard, drained);
+      mutex_unlock (&shard->lock);
+
+      ncache_release (drained, drained_count);
+      return;
+    }
+
+  /*The buffer is full: drain it and pass the hit directly, unless the
+     shard is busy, in which case the hit is not worth waiting for */
+  if (mutex_try_lock (&shard->lock))
+    {
+      drained_count = ncache_drain (shard, drained);
+      if (ncache_contains (node))
+	ncache_policy->hit (shard, node);
+      mutex_unlock (&shard->lock);
+
+      ncache_release (drained, drained_count);
+    }
+  else
+    __sync_fetch_and_add (&shard->hits_dropped[ncache_policy_index], 1);
+
+  /*The caller holds a reference, so this one is never the last */
+  netfs_nrele (node);
+}				/*ncache_hit_record */
+
+/*---------------------------------------------------------------------------*/
+/*Adds the given node to the cache, or records a new use of it if it
+  is already there, and pushes nodes out of the cache if it has grown
+  too large*/
+void ncache_node_add (node_t * node)
+{
+  /*Only the shard responsible for the node is involved */
+  ncache_t *shard = NCACHE_SHARD (node);
+
+  /*Has the shard grown too large? */
+  int overflow;
+
+  /*A hit only has to be recorded; if the node is pushed out before
+     the hit is passed to the policy, the hit is simply ignored */
+  if (ncache_contains (node))
+    {
+      ncache_hit_record (shard, node);
+      return;
+    }
+
+  /*Acquire a lock on the shard */
+  mutex_lock (&shard->lock);
+
+  /*If the node has been added in the meantime */
+  if (ncache_contains (node))
+    {
+      /*let the policy account for the new use */
+      ncache_policy->hit (shard, node);
+      __sync_fetch_and_add (&shard->hits[ncache_policy_index], 1);
+    }
+  else
+    {
+      /*add a new reference to the node */
+      netfs_nref (node);
+
+      /*let the policy place the node */
+      ncache_policy->insert (shard, node);
+      ++shard->misses[ncache_policy_index];
     }
 
-  /*While the size of the cache is exceeding the maximal size */
-/*	node_t * old_lru;
-	for
-		(
-		old_lru = ncache.lru;
-		ncache.size_current > ncache.size_max;
-		old_lru = ncache.lru
-		)
-		{*/
-  /*remove the current LRU end of the list from the cache */
-  /*ncache_node_remove(old_lru); */
-
-  /*release the reference to the node owned by this thread */
-  /*netfs_nrele(old_lru);
-     } */
-
-  /*Release the lock on the cache */
-  mutex_unlock (&ncache.lock);
+  overflow = shard->size_current > shard->size_max;
+
+  /*Release the lock on the shard */
+  mutex_unlock (&shard->lock);
+
+  /*Keep the size of the shard within the limit */
+  if (overflow)
+    ncache_shard_shrink (shard, shard->size_max);
 }				/*ncache_node_add */
 
 /*---------------------------------------------------------------------------*/
+/*Pushes the least valuable nodes out of every shard of the cache
+  while it holds more than its share of nodes*/
+void ncache_shrink (void)
+{
+  /*The shard being shrunk */
+  int i;
+
+  for (i = 0; i < NCACHE_SHARDS; ++i)
+    ncache_shard_shrink (&ncache[i], ncache[i].size_max);
+}				/*ncache_shrink */
+
+/*---------------------------------------------------------------------------*/
+/*Pushes the least valuable nodes out of the cache until it holds at
+  most `size` nodes, without changing the maximal size of the cache*/
+void ncache_trim (int size)
+{
+  /*The shard being trimmed */
+  int i;
+
+  for (i = 0; i < NCACHE_SHARDS; ++i)
+    ncache_shard_shrink (&ncache[i], size / NCACHE_SHARDS);
+}				/*ncache_trim */
+
+/*---------------------------------------------------------------------------*/
+/*Returns the number of nodes in the cache*/
+int ncache_count (void)
+{
+  /*The shard being examined and the total */
+  int i, count = 0;
+
+  for (i = 0; i < NCACHE_SHARDS; ++i)
+    count += ncache[i].size_current;
+
+  return count;
+}				/*ncache_count */
+
+/*---------------------------------------------------------------------------*/
+/*Changes the maximal number of nodes in the cache; the nodes in excess
+  are pushed out in small batches*/
+void ncache_resize (int size_max)
+{
+  /*The shard being resized */
+  int i;
+
+  for (i = 0; i < NCACHE_SHARDS; ++i)
+    {
+      mutex_lock (&ncache[i].lock);
+      ncache[i].size_max = (size_max + NCACHE_SHARDS - 1) / NCACHE_SHARDS;
+      mutex_unlock (&ncache[i].lock);
+    }
+
+  /*Every batch is pushed out with the shard unlocked in between */
+  ncache_shrink ();
+}				/*ncache_resize */
+
+/*---------------------------------------------------------------------------*/
+/*Checks whether the given node is in the cache*/
+int ncache_node_is_cached (node_t * node)
+{
+  int cached;
+
+  /*The shard responsible for the node */
+  ncache_t *shard = NCACHE_SHARD (node);
+
+  mutex_lock (&shard->lock);
+  cached = ncache_contains (node);
+  mutex_unlock (&shard->lock);
+
+  return cached;
+}				/*ncache_node_is_cached */
+
+/*---------------------------------------------------------------------------*/
+/*Chooses the replacement policy called `name`; the nodes already in
+  the cache are kept*/
+error_t ncache_policy_set (const char *name)
+{
+  /*The policy being examined */
+  const ncache_policy_t *policy;
+
+  /*The shard being switched over and the node being moved */
+  int i;
+  node_t *node;
+
+  for (policy = ncache_policies; policy->name; ++policy)
+    if (strcasecmp (policy->name, name) == 0)
+      break;
+
+  /*There is no such policy */
+  if (!policy->name)
+    return EINVAL;
+
+  /*Before the cache is set up there is nothing to switch over */
+  if (!ncache_initialized)
+    {
+      ncache_policy = policy;
+      ncache_policy_index = policy - ncache_policies;
+      return 0;
+    }
+
+  /*The policy is only used with a shard locked, so all of them must
+     be locked while it is replaced */
+  for (i = 0; i < NCACHE_SHARDS; ++i)
+    mutex_lock (&ncache[i].lock);
+
+  if (ncache_policy != policy)
+    for (i = 0; i < NCACHE_SHARDS; ++i)
+      /*Move the protected nodes to the MRU end of the only queue every
+         policy uses, keeping their order; the reference bits are
+         cleared on the way */
+      while ((node = ncache[i].queues[NCACHE_QUEUE_PROTECTED].lru) != NULL)
+	{
+	  ncache_node_remove (node);
+	  ncache_queue_push (&ncache[i], NCACHE_QUEUE_PROBATION, node);
+	}
+
+  /*From now on the hits are counted for the new policy; the few hits
+     recorded without the lock right now may still go to the old one */
+  ncache_policy = policy;
+  ncache_policy_index = policy - ncache_policies;
+
+  for (i = 0; i < NCACHE_SHARDS; ++i)
+    mutex_unlock (&ncache[i].lock);
+
+  return 0;
+}				/*ncache_policy_set */
+
+/*---------------------------------------------------------------------------*/
+/*Prints the replacement policy of the cache and the hit ratio of every
+  policy which has been used to `f`*/
+void ncache_report (FILE * f)
+{
+  /*The totals over all shards, for every policy */
+  unsigned long hits[NCACHE_POLICIES] = { 0 }, misses[NCACHE_POLICIES] = { 0 };
+  unsigned long dropped[NCACHE_POLICIES] = { 0 };
+  int size = 0, protected = 0;
+
+  /*The shard and the policy being examined */
+  int i, p;
+
+  for (i = 0; i < NCACHE_SHARDS; ++i)
+    {
+      mutex_lock (&ncache[i].lock);
+      for (p = 0; p < NCACHE_POLICIES; ++p)
+	{
+	  hits[p] += ncache[i].hits[p];
+	  misses[p] += ncache[i].misses[p];
+	  dropped[p] += ncache[i].hits_dropped[p];
+	}
+      size += ncache[i].size_current;
+      protected += ncache[i].queues[NCACHE_QUEUE_PROTECTED].size;
+      mutex_unlock (&ncache[i].lock);
+    }
+
+  fprintf (f, "node cache (%s): %d nodes (%d protected)\n",
+	   ncache_policy->name, size, protected);
+
+  /*Report the policies apart, so that they can be compared after the
+     policy has been switched at runtime */
+  for (p = 0; p < NCACHE_POLICIES; ++p)
+    if ((p == ncache_policy_index) || hits[p] || misses[p] || dropped[p])
+      fprintf (f, "node cache policy %s: %lu hits, %lu misses, "
+	       "%lu%% hit ratio, %lu hits dropped\n",
+	       ncache_policies[p].name, hits[p], misses[p],
+	       (hits[p] + misses[p])
+	       ? (hits[p] * 100 / (hits[p] + misses[p])) : (0UL), dropped[p]);
+}				/*ncache_report */
+
+/*---------------------------------------------------------------------------*/
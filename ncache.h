@@ -28,6 +28,7 @@
 
 /*---------------------------------------------------------------------------*/
 #include <error.h>
+#include <stdio.h>
 #include <hurd/netfs.h>
 /*---------------------------------------------------------------------------*/
 #include "node.h"
@@ -36,46 +37,129 @@
 /*---------------------------------------------------------------------------*/
 /*--------Macros-------------------------------------------------------------*/
 /*The default maximal cache size*/
-/*#define NCACHE_SIZE 256*/
-/*SEE ALSO the comment in ncache.c*/
+#define NCACHE_SIZE 256
+/*---------------------------------------------------------------------------*/
+/*The maximal number of nodes pushed out of the cache at once; the
+  references to them are released with the cache unlocked*/
+#define NCACHE_EVICT_BATCH 16
+/*---------------------------------------------------------------------------*/
+/*The number of independently locked parts of the cache (must be a
+  power of two)*/
+#define NCACHE_SHARDS 16
+/*---------------------------------------------------------------------------*/
+/*The queues of a shard of the cache: every policy keeps the nodes in
+  the probation queue, only 2Q moves the nodes used more than once to
+  the protected queue*/
+#define NCACHE_QUEUE_PROBATION 0
+#define NCACHE_QUEUE_PROTECTED 1
+#define NCACHE_QUEUES 2
+/*---------------------------------------------------------------------------*/
+/*The part of a shard the 2Q policy lets the probation queue occupy
+  before it evicts from it in preference to the protected queue*/
+#define NCACHE_PROBATION_SHARE 4
+/*---------------------------------------------------------------------------*/
+/*The number of hits a shard of the cache buffers before they are
+  passed to the replacement policy (must be a power of two)*/
+#define NCACHE_HIT_BUFFER 32
+/*---------------------------------------------------------------------------*/
+/*The name of the default replacement policy*/
+#define NCACHE_POLICY "lru"
+/*---------------------------------------------------------------------------*/
+/*The number of available replacement policies*/
+#define NCACHE_POLICIES 3
+/*---------------------------------------------------------------------------*/
+/*Selects the shard of the cache responsible for `node`*/
+#define NCACHE_SHARD(node)\
+	(&ncache[(((unsigned long) (node) >> 4) ^ ((unsigned long) (node) >> 10))\
+		 & (NCACHE_SHARDS - 1)])
 /*---------------------------------------------------------------------------*/
 
 /*---------------------------------------------------------------------------*/
 /*--------Types--------------------------------------------------------------*/
-/*A cache chain*/
-struct ncache
+/*A queue of cached nodes ordered from the most recently used to the
+  least recently used one*/
+struct ncache_queue
 {
-  /*the MRU end of the cache chain */
+  /*the MRU end of the queue */
   node_t *mru;
 
-  /*the LRU end of the cache chain */
+  /*the LRU end of the queue */
   node_t *lru;
 
-  /*the maximal number of nodes to cache */
-  /*int size_max; */
-  /*SEE ALSO the comment in ncache.c */
+  /*the number of nodes in the queue */
+  int size;
+};				/*struct ncache_queue */
+/*---------------------------------------------------------------------------*/
+/*A shard of the cache; the cache consists of NCACHE_SHARDS such
+  shards, each holding its own share of the nodes*/
+struct ncache
+{
+  /*the queues of nodes (see NCACHE_QUEUE_*) */
+  struct ncache_queue queues[NCACHE_QUEUES];
+
+  /*the maximal number of nodes to cache in this shard */
+  int size_max;
 
-  /*the current length of the cache chain */
+  /*the current number of nodes in this shard */
   int size_current;
 
+  /*the hits not yet passed to the replacement policy, each holding a
+     reference to its node; filled without locking the shard */
+  node_t *volatile hit_buffer[NCACHE_HIT_BUFFER];
+
+  /*the number of slots of `hit_buffer` taken so far */
+  volatile unsigned int hit_buffer_tail;
+
+  /*the number of nodes found in and missing from this shard when
+     they were added, and the number of hits discarded because the
+     buffer was full, counted for every replacement policy apart */
+  volatile unsigned long hits[NCACHE_POLICIES], misses[NCACHE_POLICIES];
+  volatile unsigned long hits_dropped[NCACHE_POLICIES];
+
   /*a lock */
   struct mutex lock;
 };				/*struct ncache */
 /*---------------------------------------------------------------------------*/
 typedef struct ncache ncache_t;
 /*---------------------------------------------------------------------------*/
+/*A replacement policy of the cache; all operations are invoked with
+  the shard locked. Hits are delivered in batches, some time after
+  they happened, and may be lost under heavy load*/
+struct ncache_policy
+{
+  /*the name of the policy, as given on the command line */
+  const char *name;
+
+  /*puts a node which has not been cached into `shard` */
+  void (*insert) (ncache_t * shard, node_t * node);
+
+  /*remarks a new use of a node already cached in `shard` */
+  void (*hit) (ncache_t * shard, node_t * node);
+
+  /*chooses the node to push out of `shard` next; returns NULL if
+     there is no node which could be pushed out */
+  node_t *(*victim) (ncache_t * shard);
+};				/*struct ncache_policy */
+/*---------------------------------------------------------------------------*/
+typedef struct ncache_policy ncache_policy_t;
+/*---------------------------------------------------------------------------*/
 
 /*---------------------------------------------------------------------------*/
 /*--------Global Variables---------------------------------------------------*/
+/*The shards of the cache*/
+extern ncache_t ncache[NCACHE_SHARDS];
+/*---------------------------------------------------------------------------*/
 /*The cache size (may be overwritten by the user)*/
-/*extern int cache_size;*/
-/*SEE ALSO the comment in ncache.c*/
+extern int ncache_size;
+/*---------------------------------------------------------------------------*/
+/*The replacement policy of the cache*/
+extern const ncache_policy_t *ncache_policy;
 /*---------------------------------------------------------------------------*/
 
 /*----------------------------------------------------------------------------*/
 /*--------Functions----------------------------------------------------------*/
 /*Initializes the node cache*/
-void ncache_init (void);
+void ncache_init (int size_max);
 /*---------------------------------------------------------------------------*/
 /*Looks up the lnode and stores the result in `node`; creates a new
   entry in the cache if the lookup fails*/
@@ -85,15 +169,43 @@ error_t ncache_node_lookup (lnode_t * lnode,	/*search for this */
 /*---------------------------------------------------------------------------*/
 /*Removes the given node from the cache. Does not release the
   reference held by the cache (for some further finalization actions
-  on the node)*/
-/*Nodes will NOT be removed from the cache automatically*/
+  on the node). The shard of the cache containing `node` must be
+  locked*/
 void ncache_node_remove (node_t * node);
 /*---------------------------------------------------------------------------*/
 /*Resets the node cache*/
 /*No references to nodes are released*/
 void ncache_reset (void);
 /*---------------------------------------------------------------------------*/
-/*Adds the given node to the cache*/
+/*Adds the given node to the cache, or records a new use of it if it
+  is already there, and pushes nodes out of the cache if it has grown
+  too large*/
 void ncache_node_add (node_t * node);
 /*---------------------------------------------------------------------------*/
+/*Pushes the least valuable nodes out of every shard of the cache
+  while it holds more than its share of nodes*/
+void ncache_shrink (void);
+/*---------------------------------------------------------------------------*/
+/*Changes the maximal number of nodes in the cache; the nodes in excess
+  are pushed out in small batches*/
+void ncache_resize (int size_max);
+/*---------------------------------------------------------------------------*/
+/*Pushes the least valuable nodes out of the cache until it holds at
+  most `size` nodes, without changing the maximal size of the cache*/
+void ncache_trim (int size);
+/*---------------------------------------------------------------------------*/
+/*Returns the number of nodes in the cache*/
+int ncache_count (void);
+/*---------------------------------------------------------------------------*/
+/*Checks whether the given node is in the cache*/
+int ncache_node_is_cached (node_t * node);
+/*---------------------------------------------------------------------------*/
+/*Chooses the replacement policy called `name`; the nodes already in
+  the cache are kept*/
+error_t ncache_policy_set (const char *name);
+/*---------------------------------------------------------------------------*/
+/*Prints the replacement policy of the cache and the hit ratio of every
+  policy which has been used to `f`*/
+void ncache_report (FILE * f);
+/*---------------------------------------------------------------------------*/
 #endif /*__NCACHE_H__*/
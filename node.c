@@ -48,6 +48,52 @@
 /*The lock protecting the underlying filesystem*/
 struct mutex ulfs_lock = MUTEX_INITIALIZER;
 /*---------------------------------------------------------------------------*/
+/*The allocator of netnodes*/
+slab_t netnode_slab = SLAB_INITIALIZER ("netnode", netnode_t);
+/*---------------------------------------------------------------------------*/
+/*The time in milliseconds for which the stat information of a node is
+  trusted*/
+int node_stat_ttl = NODE_STAT_TTL;
+/*---------------------------------------------------------------------------*/
+/*The time in milliseconds for which stale stat information is returned
+  while being refreshed in the background*/
+int node_stat_hard_ttl = NODE_STAT_HARD_TTL;
+/*---------------------------------------------------------------------------*/
+/*The maximal number of nodes keeping ports in the port pool*/
+int node_ports_max = NODE_PORTS_MAX;
+/*---------------------------------------------------------------------------*/
+/*The counters of the port pool*/
+unsigned long node_ports_count, node_ports_released, node_ports_reopened;
+/*---------------------------------------------------------------------------*/
+/*The MRU and LRU ends of the port pool and the lock protecting it; the
+  lock may be taken with a node locked, but not the other way round*/
+static node_t *node_ports_mru, *node_ports_lru;
+static struct mutex node_ports_lock = MUTEX_INITIALIZER;
+/*---------------------------------------------------------------------------*/
+/*The counters of the listings of directories*/
+unsigned long node_listing_hits, node_listing_reads;
+/*---------------------------------------------------------------------------*/
+/*The number of bytes occupied by the cached listings*/
+unsigned long node_listing_memory;
+/*---------------------------------------------------------------------------*/
+/*The directories with cached listings, from the most recently listed
+  one to the least recently listed one, and the lock protecting the list
+  (nodes are locked before it)*/
+static node_t *node_listings_mru, *node_listings_lru;
+static struct mutex node_listings_lock = MUTEX_INITIALIZER;
+/*---------------------------------------------------------------------------*/
+/*The counters of the validations of stat information*/
+unsigned long node_stat_hits, node_stat_rpcs, node_stat_refreshes;
+/*---------------------------------------------------------------------------*/
+/*The nodes whose stat information is waiting to be refreshed, with
+  a reference each*/
+static node_t *node_refresh_head, *node_refresh_tail;
+/*---------------------------------------------------------------------------*/
+/*The lock protecting the refresh queue and the condition signalled when
+  a node is queued*/
+static struct mutex node_refresh_lock = MUTEX_INITIALIZER;
+static struct condition node_refresh_wakeup;
+/*---------------------------------------------------------------------------*/
 
 /*---------------------------------------------------------------------------*/
 /*--------Functions----------------------------------------------------------*/
@@ -57,16 +103,16 @@ error_t node_create (lnode_t * lnode, node_t ** node)
   error_t err = 0;
 
   /*Create a new netnode */
-  netnode_t *netnode_new = malloc (sizeof (netnode_t));
-
-  /*Reset the memory allocated for the new netnode (just in case :-) ) */
-  memset (netnode_new, 0, sizeof (netnode_t));
+  netnode_t *netnode_new = slab_alloc (&netnode_slab);
 
   /*If the memory could not be allocated */
   if (netnode_new == NULL)
     err = ENOMEM;
   else
     {
+      /*reset the memory allocated for the new netnode (just in case :-) ) */
+      memset (netnode_new, 0, sizeof (netnode_t));
+
       /*create a new node from the netnode */
       node_t *node_new = netfs_make_node (netnode_new);
 
@@ -77,7 +123,7 @@ error_t node_create (lnode_t * lnode, node_t ** node)
 	  err = ENOMEM;
 
 	  /*destroy the netnode created above */
-	  free (netnode_new);
+	  slab_free (&netnode_slab, netnode_new);
 
 	  /*stop */
 	  return err;
@@ -85,9 +131,6 @@ error_t node_create (lnode_t * lnode, node_t ** node)
 
       node_new->nn->type = NODE_TYPE_NORMAL;
 
-      /*link the lnode to the new node */
-      lnode->node = node_new;
-
       /*setup the references in the newly created node */
       node_new->nn->lnode = lnode;
       lnode_ref_add (lnode);
@@ -95,12 +138,28 @@ error_t node_create (lnode_t * lnode, node_t ** node)
       /*setup the information in the netnode */
       node_new->nn->flags = 0;
       node_new->nn->ncache_next = node_new->nn->ncache_prev = NULL;
+      node_new->nn->ncache_queue = node_new->nn->ncache_referenced = 0;
+      node_new->nn->ncache_resident = 0;
+      node_new->nn->stat_time = node_new->nn->stat_gen = 0;
+      node_new->nn->refresh_next = NULL;
+      node_new->nn->stat_port = MACH_PORT_NULL;
+      node_new->nn->port_prev = node_new->nn->port_next = NULL;
+      node_new->nn->port_pooled = 0;
+      node_new->nn->listing = NULL;
+      node_new->nn->listing_prev = node_new->nn->listing_next = NULL;
+      node_new->nn->dir_size_listed = 0;
 
       /*initialize the data fields dealing with positioning this node
 	in the dynamic translator stack */
       node_new->nn->dyntrans = NULL;
       node_new->nn->below = NULL;
 
+      /*link the lnode to the new node, which is complete now; lookups
+	 read the link under netfs_node_refcnt_lock */
+      spin_lock (&netfs_node_refcnt_lock);
+      lnode->node = node_new;
+      spin_unlock (&netfs_node_refcnt_lock);
+
       /*store the result of creation in the second parameter */
       *node = node_new;
     }
@@ -109,25 +168,87 @@ error_t node_create (lnode_t * lnode, node_t ** node)
   return err;
 }				/*node_create */
 
+/*---------------------------------------------------------------------------*/
+/*Finds a proxy of `lnode` which is referenced by the node cache only
+  and has no translator sitting on it, and prepares it for being
+  handed out as a new proxy. The result is locked*/
+static error_t node_proxy_reuse (lnode_t * lnode, node_t ** node)
+{
+  /*The proxy being examined */
+  node_t *np;
+
+  /*Is the current proxy idle? */
+  int idle;
+
+  /*Go through the proxies of `lnode` */
+  for (np = lnode->proxies; np; np = np->nn->proxy_next)
+    {
+      /*A proxy with a translator is never idle; skip busy proxies, too */
+      if (np->nn->dyntrans || !mutex_try_lock (&np->lock))
+	continue;
+
+      /*If the only reference is the one held by the cache, take another
+	 one for the caller in the same step */
+      idle = ncache_node_is_cached (np);
+      spin_lock (&netfs_node_refcnt_lock);
+      idle = idle && (np->references == 1);
+      if (idle)
+	++np->references;
+      spin_unlock (&netfs_node_refcnt_lock);
+
+      if (idle)
+	{
+	  /*reset the proxy to the state of a newly created one: nothing
+	     cached for the previous translator may be served any more */
+	  node_port_pool_remove (np);
+	  if (np->nn->port != MACH_PORT_NULL)
+	    PORT_DEALLOC (np->nn->port);
+	  np->nn->port = MACH_PORT_NULL;
+	  if (np->nn->stat_port != MACH_PORT_NULL)
+	    PORT_DEALLOC (np->nn->stat_port);
+	  np->nn->stat_port = MACH_PORT_NULL;
+	  np->nn->type = NODE_TYPE_PROXY;
+	  np->nn->flags = 0;
+	  node_stat_invalidate (np);
+	  node_listing_drop (np);
+	  np->nn->dir_size_listed = 0;
+
+	  *node = np;
+	  return 0;
+	}
+
+      mutex_unlock (&np->lock);
+    }
+
+  /*All proxies are in use */
+  return EAGAIN;
+}				/*node_proxy_reuse */
+
 /*---------------------------------------------------------------------------*/
 /*Derives a new proxy from `lnode`*/
 error_t node_create_proxy (lnode_t * lnode, node_t ** node)
 {
   error_t err = 0;
 
-  /*Create a new netnode */
-  netnode_t *netnode_new = malloc (sizeof (netnode_t));
+  /*If `lnode` has as many proxies as allowed, try to reuse an idle one;
+    when all of them are busy, fall back to creating a new proxy */
+  if ((lnode_proxies_max > 0) && (lnode->proxies_count >= lnode_proxies_max)
+      && (node_proxy_reuse (lnode, node) == 0))
+    return 0;
 
-  /*Reset the memory allocated for the new netnode. We do this here
-     since lnode_add_proxy will try to reference the `lnode` in this
-     netnode and will do bad writes to memory. */
-  memset (netnode_new, 0, sizeof (netnode_t));
+  /*Create a new netnode */
+  netnode_t *netnode_new = slab_alloc (&netnode_slab);
 
   /*If the memory could not be allocated */
   if (netnode_new == NULL)
     err = ENOMEM;
   else
     {
+      /*reset the memory allocated for the new netnode. We do this here
+	 since lnode_add_proxy will try to reference the `lnode` in this
+	 netnode and will do bad writes to memory. */
+      memset (netnode_new, 0, sizeof (netnode_t));
+
       /*create a new node from the netnode */
       node_t *node_new = netfs_make_node (netnode_new);
 
@@ -138,7 +259,7 @@ error_t node_create_proxy (lnode_t * lnode, node_t ** node)
 	  err = ENOMEM;
 
 	  /*destroy the netnode created above */
-	  free (netnode_new);
+	  slab_free (&netnode_slab, netnode_new);
 
 	  /*stop */
 	  return err;
@@ -152,6 +273,16 @@ error_t node_create_proxy (lnode_t * lnode, node_t ** node)
       /*setup the information in the netnode */
       node_new->nn->flags = 0;
       node_new->nn->ncache_next = node_new->nn->ncache_prev = NULL;
+      node_new->nn->ncache_queue = node_new->nn->ncache_referenced = 0;
+      node_new->nn->ncache_resident = 0;
+      node_new->nn->stat_time = node_new->nn->stat_gen = 0;
+      node_new->nn->refresh_next = NULL;
+      node_new->nn->stat_port = MACH_PORT_NULL;
+      node_new->nn->port_prev = node_new->nn->port_next = NULL;
+      node_new->nn->port_pooled = 0;
+      node_new->nn->listing = NULL;
+      node_new->nn->listing_prev = node_new->nn->listing_next = NULL;
+      node_new->nn->dir_size_listed = 0;
 
       /*initialize the data fields dealing with positioning this node
 	in the dynamic translator stack */
@@ -173,16 +304,16 @@ error_t node_create_from_port (mach_port_t port, node_t ** node)
   error_t err = 0;
 
   /*Create a new netnode */
-  netnode_t * netnode_new = malloc (sizeof (netnode_t));
-
-  /*Reset the memory allocated for the new netnode (just in case :-) ) */
-  memset (netnode_new, 0, sizeof (netnode_t));
+  netnode_t * netnode_new = slab_alloc (&netnode_slab);
 
   /*If the memory could not be allocated */
   if (netnode_new == NULL)
     err = ENOMEM;
   else
     {
+      /*reset the memory allocated for the new netnode (just in case :-) ) */
+      memset (netnode_new, 0, sizeof (netnode_t));
+
       /*create a new node from the netnode */
       node_t * node_new = netfs_make_node (netnode_new);
 
@@ -193,7 +324,7 @@ error_t node_create_from_port (mach_port_t port, node_t ** node)
 	  err = ENOMEM;
 
 	  /*destroy the netnode created above */
-	  free (netnode_new);
+	  slab_free (&netnode_slab, netnode_new);
 
 	  /*stop */
 	  return err;
@@ -210,6 +341,16 @@ error_t node_create_from_port (mach_port_t port, node_t ** node)
       /*setup the information in the netnode */
       node_new->nn->flags = 0;
       node_new->nn->ncache_next = node_new->nn->ncache_prev = NULL;
+      node_new->nn->ncache_queue = node_new->nn->ncache_referenced = 0;
+      node_new->nn->ncache_resident = 0;
+      node_new->nn->stat_time = node_new->nn->stat_gen = 0;
+      node_new->nn->refresh_next = NULL;
+      node_new->nn->stat_port = MACH_PORT_NULL;
+      node_new->nn->port_prev = node_new->nn->port_next = NULL;
+      node_new->nn->port_pooled = 0;
+      node_new->nn->listing = NULL;
+      node_new->nn->listing_prev = node_new->nn->listing_next = NULL;
+      node_new->nn->dir_size_listed = 0;
       node_new->nn->port = port;
 
       /*initialize the data fields dealing with positioning this node
@@ -227,40 +368,58 @@ error_t node_create_from_port (mach_port_t port, node_t ** node)
 
 /*---------------------------------------------------------------------------*/
 /*Destroys the specified node and removes a light reference from the
-  associated light node*/
+  associated light node. Called by netfs_node_norefs with
+  netfs_node_refcnt_lock held; the lock is released while the node is
+  torn down and taken again before returning*/
 void node_destroy (node_t * np)
 {
+  /*The lnode associated with the node */
+  lnode_t *lnode = np->nn->lnode;
+
+  /*Is the node the one lookups of `lnode` find? */
+  int linked = lnode && (lnode->node == np);
+
   /*Die if the node does not belong to node cache */
   assert (!np->nn->ncache_next || !np->nn->ncache_prev);
 
+  /*Make the node unreachable while the refcount lock is still held,
+     so that ncache_node_lookup cannot take a reference to it */
+  if (linked)
+    lnode->node = NULL;
+
+  /*Everything below waits for mutexes, which must not happen under a
+     spin lock: a lookup holds the lock of the lnode while it takes a
+     reference to the node */
+  spin_unlock (&netfs_node_refcnt_lock);
+
+  /*Nobody may give up the ports of the node any more */
+  node_port_pool_remove (np);
+
   /*Destroy the port to the underlying filesystem allocated to the node */
   if (np->nn->port != MACH_PORT_NULL)
     PORT_DEALLOC (np->nn->port);
+  if (np->nn->stat_port != MACH_PORT_NULL)
+    PORT_DEALLOC (np->nn->stat_port);
+
+  /*Drop the cached listing */
+  node_listing_drop (np);
 
   /*TODO: If this node is a shadow node, kill the translator sitting
     on this node. */
 
-  /*If there is an lnode associated with the current node, detach
-    it */
-  if (np->nn->lnode)
-    {
-      if (np->nn->lnode->node == np)
-	{
-	  mutex_lock (&np->nn->lnode->lock);
-
-	  /*orphan the light node */
-	  np->nn->lnode->node = NULL;
-
-	  lnode_ref_remove (np->nn->lnode);
-	}
-      else
-	/*remove a reference to this node from the list of proxies */
-	lnode_remove_proxy (np->nn->lnode, np);
-    }
+  /*If there is an lnode associated with the current node, drop the
+    reference the node holds to it */
+  if (linked)
+    lnode_ref_remove (lnode);
+  else if (lnode)
+    /*remove a reference to this node from the list of proxies */
+    lnode_remove_proxy (lnode, np);
 
   /*Free the netnode and the node itself */
-  free (np->nn);
+  slab_free (&netnode_slab, np->nn);
   free (np);
+
+  spin_lock (&netfs_node_refcnt_lock);
 }				/*node_destroy */
 
 /*---------------------------------------------------------------------------*/
@@ -354,6 +513,7 @@ error_t node_init_root (node_t * node	/*the root node */
       LOG_MSG ("node_init_root: Could not strdup the directory.");
       return ENOMEM;
     }
+  node->nn->lnode->path_len = strlen (dir);
 
   /*The current position in dir */
   char *p = dir + strlen (dir);
@@ -382,10 +542,13 @@ error_t node_init_root (node_t * node	/*the root node */
 
   LOG_MSG ("node_init_root: The name of root node is %s.", p);
 
+  /*The interned copy of the name of the root node */
+  intern_name_t *iname;
+
   /*Set the name of the lnode to the last element in the path to dir */
-  node->nn->lnode->name = strdup (p);
-  /*If the name of the node could not be duplicated */
-  if (!node->nn->lnode->name)
+  err = intern_get (p, strlen (p), &iname);
+  /*If the name of the node could not be interned */
+  if (err)
     {
       /*free the name of the path to the node and deallocate teh port */
       free (node->nn->lnode->path);
@@ -394,12 +557,15 @@ error_t node_init_root (node_t * node	/*the root node */
       /*unlock the mutex */
       mutex_unlock (&ulfs_lock);
 
-      LOG_MSG ("node_init_root: Could not strdup the name of the root node.");
-      return ENOMEM;
+      LOG_MSG ("node_init_root: Could not intern the name of the root node.");
+      return err;
     }
 
-  /*Compute the length of the name of the root node */
-  node->nn->lnode->name_len = strlen (p);
+  /*Replace the old name of the root node, if any */
+  if (node->nn->lnode->iname)
+    intern_release (node->nn->lnode->iname);
+  node->nn->lnode->iname = iname;
+  node->nn->lnode->name = iname->str;
 
   /*Release the lock for operations on the undelying filesystem */
   mutex_unlock (&ulfs_lock);
@@ -409,131 +575,849 @@ error_t node_init_root (node_t * node	/*the root node */
 }				/*node_init_root */
 
 /*---------------------------------------------------------------------------*/
-/*Frees a list of dirents*/
-void node_entries_free (node_dirent_t * dirents)
+/*Checks whether the stat information of `node` may be used without
+  asking the underlying filesystem*/
+int node_stat_fresh (node_t * node)
 {
-  /*The current and the next elements */
-  node_dirent_t *dirent, *dirent_next;
+  if ((node_stat_ttl <= 0) || (node->nn->stat_time == 0))
+    return 0;
 
-  /*Go through all elements of the list */
-  for (dirent = dirents; dirent; dirent = dirent_next)
-    {
-      /*store the next element */
-      dirent_next = dirent->next;
+  return time_ms () - node->nn->stat_time < (unsigned long) node_stat_ttl;
+}				/*node_stat_fresh */
 
-      /*free the dirent stored in the current element of the list */
-      free (dirent->dirent);
+/*---------------------------------------------------------------------------*/
+/*Checks whether the stat information of `node` is stale, but may still
+  be returned while it is being refreshed in the background*/
+int node_stat_usable (node_t * node)
+{
+  if ((node_stat_hard_ttl <= node_stat_ttl) || (node->nn->stat_time == 0))
+    return 0;
 
-      /*free the current element */
-      free (dirent);
-    }
-}				/*node_entries_free */
+  return time_ms () - node->nn->stat_time
+    < (unsigned long) node_stat_hard_ttl;
+}				/*node_stat_usable */
 
 /*---------------------------------------------------------------------------*/
-/*Reads the directory entries from `node`, which must be locked*/
-error_t node_entries_get (node_t * node, node_dirent_t ** dirents)
+/*Remarks that the stat information of `node` has just been fetched from
+  the underlying filesystem*/
+void node_stat_fetched (node_t * node)
 {
-  error_t err = 0;
+  node->nn->stat_time = time_ms ();
+}				/*node_stat_fetched */
 
-  /*The list of dirents */
-  struct dirent **dirent_list, **dirent;
+/*---------------------------------------------------------------------------*/
+/*Forces the stat information of `node` to be fetched anew, also
+  discarding any refresh under way*/
+void node_stat_invalidate (node_t * node)
+{
+  node->nn->stat_time = 0;
+  ++node->nn->stat_gen;
+}				/*node_stat_invalidate */
+
+/*---------------------------------------------------------------------------*/
+/*Gives up the port kept for the stat of the locked `node` once it has
+  been kept for longer than stat information may be served, so that the
+  name is looked up again and a file replaced meanwhile is noticed*/
+void node_stat_port_expire (node_t * node)
+{
+  /*The longest time for which stat information may be served */
+  int ttl = (node_stat_hard_ttl > node_stat_ttl)
+    ? (node_stat_hard_ttl) : (node_stat_ttl);
 
-  /*The head of the list of dirents */
-  node_dirent_t *node_dirent_list = NULL;
+  if ((node->nn->stat_port == MACH_PORT_NULL)
+      || ((ttl > 0)
+	  && (time_ms () - node->nn->stat_port_time < (unsigned long) ttl)))
+    return;
 
-  /*The size of the array of pointers to dirent */
-  size_t dirent_data_size;
+  /*A file keeps no other port, so it leaves the pool */
+  if (node->nn->port == MACH_PORT_NULL)
+    node_port_pool_remove (node);
 
-  /*The array of dirents */
-  char *dirent_data;
+  PORT_DEALLOC (node->nn->stat_port);
+  node->nn->stat_port = MACH_PORT_NULL;
+}				/*node_stat_port_expire */
 
-  /*Obtain the directory entries for the given node */
-  err = dir_entries_get
-    (node->nn->port, &dirent_data, &dirent_data_size, &dirent_list);
-  if (err)
+/*---------------------------------------------------------------------------*/
+/*Obtains the stat information of the file behind the node with `lnode`
+  and `port` (MACH_PORT_NULL if the node keeps no port) into `stat`. If
+  `opened` is not NULL, the port opened for a node without one is
+  stored there instead of being deallocated*/
+error_t node_stat_obtain (lnode_t * lnode, mach_port_t port,
+			  io_statbuf_t * stat, mach_port_t * opened)
+{
+  error_t err;
+
+  /*The parent node of the node */
+  node_t *dnp;
+
+  /*The port to the file opened for the stat */
+  mach_port_t p;
+
+  if (opened)
+    *opened = MACH_PORT_NULL;
+
+  /*Directories and the files kept in the port pool have an open port */
+  if (port != MACH_PORT_NULL)
+    return io_stat (port, stat);
+
+  /*We, most probably, have something which is not a directory.
+     Therefore we will open the port and, unless the port pool wants
+     it, close it after the stat, so that additional resources are not
+     consumed. */
+
+  /*obtain the parent node of the the current node */
+  err = ncache_node_lookup (lnode->dir, &dnp);
+
+  /*the lookup should never fail here */
+  assert (!err);
+
+  /*the parent may have given up its port */
+  err = node_port_ensure (dnp);
+  if (err || (dnp->nn->port == MACH_PORT_NULL))
     {
-      return err;
+      netfs_nput (dnp);
+      return err ? err : EBADF;
     }
 
-  /*The new entry in the list */
-  node_dirent_t *node_dirent_new;
+  /*open a port to the file we are interested in */
+  p = file_name_lookup_under (dnp->nn->port, lnode->name, 0, 0);
+
+  /*put `dnp` back, since we don't need it any more */
+  netfs_nput (dnp);
+
+  if (!p)
+    return EBADF;
+
+  /*try to stat the node */
+  err = io_stat (p, stat);
+
+  /*hand the port over or deallocate it */
+  if (!err && opened)
+    *opened = p;
+  else
+    PORT_DEALLOC (p);
+
+  return err;
+}				/*node_stat_obtain */
+
+/*---------------------------------------------------------------------------*/
+/*Checks whether the ports of `node` may be given up and reopened
+  later; only mirrored files which node_update knows how to reopen are
+  eligible*/
+static int node_port_poolable (node_t * node)
+{
+  return (node_ports_max > 0) && (node->nn->type == NODE_TYPE_NORMAL)
+    && !(node->nn->flags & FLAG_NODE_ULFS_FIXED) && !NODE_IS_ROOT (node);
+}				/*node_port_poolable */
+
+/*---------------------------------------------------------------------------*/
+/*Unlinks `node` from the port pool, which must be locked*/
+static void node_port_unlink (node_t * node)
+{
+  if (node->nn->port_next)
+    node->nn->port_next->nn->port_prev = node->nn->port_prev;
+  else
+    node_ports_lru = node->nn->port_prev;
+
+  if (node->nn->port_prev)
+    node->nn->port_prev->nn->port_next = node->nn->port_next;
+  else
+    node_ports_mru = node->nn->port_next;
 
-  /*The new dirent */
-  struct dirent *dirent_new;
+  node->nn->port_prev = node->nn->port_next = NULL;
+  node->nn->port_pooled = 0;
+  --node_ports_count;
+}				/*node_port_unlink */
 
-  /*LOG_MSG("node_entries_get: Getting entries for %p", node); */
+/*---------------------------------------------------------------------------*/
+/*Gives up the ports of the locked `node`, which has already been
+  removed from the port pool; the port of a directory will be reopened
+  by node_update when it is needed again*/
+static void node_port_release (node_t * node)
+{
+  if (node->nn->port != MACH_PORT_NULL)
+    {
+      PORT_DEALLOC (node->nn->port);
+      node->nn->port = MACH_PORT_NULL;
+      node->nn->flags &= ~FLAG_NODE_ULFS_UPTODATE;
+      node->nn->flags |= FLAG_NODE_PORT_RELEASED;
+    }
 
-  /*The name of the current dirent */
-  char *name;
+  if (node->nn->stat_port != MACH_PORT_NULL)
+    {
+      PORT_DEALLOC (node->nn->stat_port);
+      node->nn->stat_port = MACH_PORT_NULL;
+    }
 
-  /*The length of the current name */
-  size_t name_len;
+  ++node_ports_released;
+}				/*node_port_release */
 
-  /*The size of the current dirent */
-  size_t size;
+/*---------------------------------------------------------------------------*/
+/*Gives up the ports of the least recently used nodes while the port
+  pool, which must be locked, holds more nodes than allowed. The nodes
+  busy at the moment are skipped. If the pool has been disabled, the
+  directories leave it with their ports and the other files lose the
+  ports kept for the stat*/
+static void node_port_pool_trim_locked (void)
+{
+  /*The node being examined and the one used more recently */
+  node_t *np, *prev;
 
-  /*Go through all elements of the list of pointers to dirent */
-  for (dirent = dirent_list; *dirent; ++dirent)
+  for (np = node_ports_lru;
+       np && ((node_ports_max <= 0)
+	      || (node_ports_count > (unsigned long) node_ports_max));
+       np = prev)
     {
-      /*obtain the name of the current dirent */
-      name = &((*dirent)->d_name[0]);
+      prev = np->nn->port_prev;
 
-      /*If the current dirent is either '.' or '..', skip it */
-      if ((strcmp (name, ".") == 0) || (strcmp (name, "..") == 0))
+      /*The usual order is to lock the node first, so only try */
+      if (!mutex_try_lock (&np->lock))
 	continue;
 
-      /*obtain the length of the current name */
-      name_len = strlen (name);
+      node_port_unlink (np);
+      if (node_ports_max > 0)
+	node_port_release (np);
+      else if (np->nn->stat_port != MACH_PORT_NULL)
+	{
+	  PORT_DEALLOC (np->nn->stat_port);
+	  np->nn->stat_port = MACH_PORT_NULL;
+	}
 
-      /*obtain the length of the current dirent */
-      size = DIRENT_LEN (name_len);
+      mutex_unlock (&np->lock);
+    }
+}				/*node_port_pool_trim_locked */
 
-      /*create a new list element */
-      node_dirent_new = malloc (sizeof (node_dirent_t));
-      if (!node_dirent_new)
+/*---------------------------------------------------------------------------*/
+/*Puts the locked `node`, which has just opened or used a port, at the
+  MRU end of the port pool and gives up the ports of the least recently
+  used nodes beyond the limit*/
+void node_port_pool_add (node_t * node)
+{
+  /*A node which may not give its ports up keeps a directory port
+     forever, as it always did, but no port just for the stat */
+  if (!node_port_poolable (node))
+    {
+      node_port_pool_remove (node);
+      if (node->nn->stat_port != MACH_PORT_NULL)
 	{
-	  err = ENOMEM;
-	  break;
+	  PORT_DEALLOC (node->nn->stat_port);
+	  node->nn->stat_port = MACH_PORT_NULL;
+	}
+      return;
+    }
+
+  /*There is nothing to keep track of */
+  if (NODE_STAT_PORT (node) == MACH_PORT_NULL)
+    return;
+
+  mutex_lock (&node_ports_lock);
+
+  /*If the node is at the MRU end already, there is nothing to do */
+  if (node_ports_mru != node)
+    {
+      if (node->nn->port_pooled)
+	node_port_unlink (node);
+
+      node->nn->port_prev = NULL;
+      node->nn->port_next = node_ports_mru;
+      if (node_ports_mru)
+	node_ports_mru->nn->port_prev = node;
+      else
+	node_ports_lru = node;
+      node_ports_mru = node;
+
+      node->nn->port_pooled = 1;
+      ++node_ports_count;
+
+      node_port_pool_trim_locked ();
+    }
+
+  mutex_unlock (&node_ports_lock);
+}				/*node_port_pool_add */
+
+/*---------------------------------------------------------------------------*/
+/*Removes the locked `node` from the port pool, keeping its ports*/
+void node_port_pool_remove (node_t * node)
+{
+  if (!node->nn->port_pooled)
+    return;
+
+  mutex_lock (&node_ports_lock);
+  if (node->nn->port_pooled)
+    node_port_unlink (node);
+  mutex_unlock (&node_ports_lock);
+}				/*node_port_pool_remove */
+
+/*---------------------------------------------------------------------------*/
+/*Gives up the ports of the least recently used nodes while the port
+  pool holds more nodes than allowed*/
+void node_port_pool_trim (void)
+{
+  mutex_lock (&node_ports_lock);
+  node_port_pool_trim_locked ();
+  mutex_unlock (&node_ports_lock);
+}				/*node_port_pool_trim */
+
+/*---------------------------------------------------------------------------*/
+/*Reopens the port of the locked `node` if it has been given up*/
+error_t node_port_ensure (node_t * node)
+{
+  error_t err;
+
+  if ((node->nn->port != MACH_PORT_NULL)
+      || !(node->nn->flags & FLAG_NODE_PORT_RELEASED))
+    return 0;
+
+  err = node_update (node);
+  if (!err && (node->nn->port != MACH_PORT_NULL))
+    __sync_fetch_and_add (&node_ports_reopened, 1);
+
+  return err;
+}				/*node_port_ensure */
+
+/*---------------------------------------------------------------------------*/
+/*Queues the stat information of the locked `node` for a refresh in the
+  background, unless it is already queued*/
+void node_stat_refresh_queue (node_t * node)
+{
+  if (node->nn->flags & FLAG_NODE_REFRESHING)
+    return;
+
+  /*The queue keeps the node alive until it is refreshed */
+  node->nn->flags |= FLAG_NODE_REFRESHING;
+  netfs_nref (node);
+
+  mutex_lock (&node_refresh_lock);
+
+  /*append the node to the queue */
+  node->nn->refresh_next = NULL;
+  if (node_refresh_tail)
+    node_refresh_tail->nn->refresh_next = node;
+  else
+    node_refresh_head = node;
+  node_refresh_tail = node;
+
+  condition_signal (&node_refresh_wakeup);
+  mutex_unlock (&node_refresh_lock);
+}				/*node_stat_refresh_queue */
+
+/*---------------------------------------------------------------------------*/
+/*The body of the thread which refreshes the queued stat information;
+  the RPCs are done with the node unlocked, so that the clients of the
+  node are never held up by a slow underlying filesystem*/
+static void *node_stat_refresh_thread (void *arg)
+{
+  /*The node being refreshed, its lnode, its port and the port opened
+     for the stat */
+  node_t *np;
+  lnode_t *lnode;
+  mach_port_t port, opened;
+
+  /*The generation of the stat information when the refresh started */
+  unsigned int gen;
+
+  /*The fresh stat information */
+  io_statbuf_t stat;
+
+  error_t err;
+
+  for (;;)
+    {
+      /*Wait for a node to refresh */
+      mutex_lock (&node_refresh_lock);
+      while (!node_refresh_head)
+	condition_wait (&node_refresh_wakeup, &node_refresh_lock);
+
+      np = node_refresh_head;
+      node_refresh_head = np->nn->refresh_next;
+      if (!node_refresh_head)
+	node_refresh_tail = NULL;
+      mutex_unlock (&node_refresh_lock);
+
+      /*Copy what is needed for the RPCs, with a right of our own to
+         the port, which might be replaced meanwhile; a port kept for
+         too long is not trusted to still name the file */
+      mutex_lock (&np->lock);
+      node_stat_port_expire (np);
+      lnode = np->nn->lnode;
+      gen = np->nn->stat_gen;
+      port = NODE_STAT_PORT (np);
+      if (port != MACH_PORT_NULL)
+	mach_port_mod_refs (mach_task_self (), port,
+			    MACH_PORT_RIGHT_SEND, 1);
+      mutex_unlock (&np->lock);
+
+      __sync_fetch_and_add (&node_stat_rpcs, 1);
+      err = node_stat_obtain (lnode, port, &stat, &opened);
+
+      mutex_lock (&np->lock);
+
+      /*Store the result, unless the stat information has been
+         invalidated in the meantime (node_update may well have got the
+         same port name for another file) */
+      if (!err && (np->nn->stat_gen == gen))
+	{
+	  np->nn_stat = stat;
+	  if (np->nn->port != MACH_PORT_NULL)
+	    np->nn_translated = stat.st_mode;
+	  node_stat_fetched (np);
+	  __sync_fetch_and_add (&node_stat_refreshes, 1);
+
+	  /*keep the port opened for the stat, if the pool wants it and
+	     no other port has been kept meanwhile */
+	  if ((opened != MACH_PORT_NULL)
+	      && (NODE_STAT_PORT (np) == MACH_PORT_NULL))
+	    {
+	      np->nn->stat_port = opened;
+	      np->nn->stat_port_time = time_ms ();
+	      opened = MACH_PORT_NULL;
+	    }
+	  node_port_pool_add (np);
 	}
 
-      /*create a new dirent */
-      dirent_new = malloc (size);
-      if (!dirent_new)
+      if (opened != MACH_PORT_NULL)
+	PORT_DEALLOC (opened);
+
+      np->nn->flags &= ~FLAG_NODE_REFRESHING;
+
+      if (port != MACH_PORT_NULL)
+	PORT_DEALLOC (port);
+
+      /*Unlock the node and drop the reference held by the queue */
+      netfs_nput (np);
+    }
+
+  return NULL;
+}				/*node_stat_refresh_thread */
+
+/*---------------------------------------------------------------------------*/
+/*Starts the thread which refreshes the queued stat information*/
+void node_stat_refresh_init (void)
+{
+  condition_init (&node_refresh_wakeup);
+  cthread_detach (cthread_fork ((cthread_fn_t) node_stat_refresh_thread, 0));
+}				/*node_stat_refresh_init */
+
+/*---------------------------------------------------------------------------*/
+/*Obtains the modification and status change times of the locked
+  directory `dir`*/
+static error_t node_listing_stamp (node_t * dir, time_t * mtime,
+				   time_t * ctime)
+{
+  error_t err;
+
+  /*The stat information of the root directory */
+  io_statbuf_t stat;
+
+  /*The stat information of the root node is not the one of the
+     underlying directory, so ask the underlying directory directly */
+  if (dir == netfs_root_node)
+    {
+      err = io_stat (dir->nn->port, &stat);
+      if (!err)
 	{
-	  free (node_dirent_new);
-	  err = ENOMEM;
-	  break;
+	  *mtime = stat.st_mtime;
+	  *ctime = stat.st_ctime;
 	}
+      return err;
+    }
+
+  /*Other directories keep their stat information up to date */
+  err = netfs_validate_stat (dir, NULL);
+  if (!err)
+    {
+      *mtime = dir->nn_stat.st_mtime;
+      *ctime = dir->nn_stat.st_ctime;
+    }
+  return err;
+}				/*node_listing_stamp */
+
+/*---------------------------------------------------------------------------*/
+/*Frees the cached listing of `dir` and takes `dir` out of the list of
+  cached listings, which must be locked*/
+static void node_listing_unlink (node_t * dir)
+{
+  netnode_t *nn = dir->nn;
+
+  /*The listing and the chunk being freed */
+  node_listing_t *l = nn->listing;
+  node_listing_segment_t *segment;
+
+  if (nn->listing_prev)
+    nn->listing_prev->nn->listing_next = nn->listing_next;
+  else
+    node_listings_mru = nn->listing_next;
+  if (nn->listing_next)
+    nn->listing_next->nn->listing_prev = nn->listing_prev;
+  else
+    node_listings_lru = nn->listing_prev;
+  nn->listing_prev = nn->listing_next = NULL;
 
-      /*fill the dirent with information */
-      dirent_new->d_ino = (*dirent)->d_ino;
-      dirent_new->d_type = (*dirent)->d_type;
-      dirent_new->d_reclen = size;
-      strcpy ((char *) dirent_new + DIRENT_NAME_OFFS, name);
+  for (segment = l->segments; segment < l->segments + NODE_LISTING_SEGMENTS;
+       ++segment)
+    if (segment->chunk >= 0)
+      {
+	munmap (segment->buffer, segment->buffer_size);
+	free (segment->offsets);
+      }
 
-      /*add the dirent to the list */
-      node_dirent_new->dirent = dirent_new;
-      node_dirent_new->next = node_dirent_list;
-      node_dirent_list = node_dirent_new;
+  __sync_fetch_and_sub (&node_listing_memory, l->memory);
+  free (l->chunk_first);
+  free (l);
+  nn->listing = NULL;
+}				/*node_listing_unlink */
+
+/*---------------------------------------------------------------------------*/
+/*Drops the cached listing of the locked `dir`*/
+void node_listing_drop (node_t * dir)
+{
+  if (!dir->nn->listing)
+    return;
+
+  mutex_lock (&node_listings_lock);
+  node_listing_unlink (dir);
+  mutex_unlock (&node_listings_lock);
+}				/*node_listing_drop */
+
+/*---------------------------------------------------------------------------*/
+/*Drops the oldest cached listings until they occupy at most `limit`
+  bytes; the listings of directories which are locked at the moment are
+  skipped*/
+void node_listing_trim (unsigned long limit)
+{
+  /*The directory being examined and the one listed before it */
+  node_t *node, *prev;
+
+  mutex_lock (&node_listings_lock);
+
+  /*The list is locked after the nodes, so only try to lock them; a
+     node being destroyed is locked, so it is never touched here */
+  for (node = node_listings_lru; node && (node_listing_memory > limit);
+       node = prev)
+    {
+      prev = node->nn->listing_prev;
+
+      if (mutex_try_lock (&node->lock))
+	{
+	  node_listing_unlink (node);
+	  mutex_unlock (&node->lock);
+	}
     }
 
-  /*If something went wrong in the loop */
+  mutex_unlock (&node_listings_lock);
+}				/*node_listing_trim */
+
+/*---------------------------------------------------------------------------*/
+/*Stores in `listing` the listing of the locked directory `dir`, which
+  is started anew only if the directory has changed since the cached
+  listing was started. The listing belongs to `dir` and stays valid
+  while `dir` is locked*/
+error_t node_listing_get (node_t * dir, node_listing_t ** listing)
+{
+  error_t err;
+
+  /*The times of the directory */
+  time_t mtime, ctime;
+
+  /*The listing being made and its chunks */
+  node_listing_t *l = dir->nn->listing;
+  node_listing_segment_t *segment;
+
+  err = node_listing_stamp (dir, &mtime, &ctime);
   if (err)
-    /*free the list of dirents */
-    node_entries_free (node_dirent_list);
+    return err;
+
+  /*The cached listing can be used if the directory has not changed
+     since, and the listing was not made in the same second as the last
+     change, which the times could not tell from a later change */
+  if (l && (l->mtime == mtime) && (l->ctime == ctime) && (l->listed > mtime))
+    {
+      __sync_fetch_and_add (&node_listing_hits, 1);
+      *listing = l;
+      return 0;
+    }
+
+  /*Start an empty listing; the chunks are read when they are needed */
+  l = malloc (sizeof (node_listing_t));
+  if (!l)
+    return ENOMEM;
+  l->chunk_first = malloc (sizeof (int));
+  if (!l->chunk_first)
+    {
+      free (l);
+      return ENOMEM;
+    }
+
+  l->mtime = mtime;
+  l->ctime = ctime;
+  l->listed = time_s ();
+  l->chunks = l->complete = 0;
+  l->chunk_first[0] = 0;
+  l->count = 0;
+  l->size = 0;
+  for (segment = l->segments; segment < l->segments + NODE_LISTING_SEGMENTS;
+       ++segment)
+    segment->chunk = -1;
+  l->clock = 0;
+  l->memory = sizeof (node_listing_t) + sizeof (int);
+
+  /*A directory changed later than now, as a filesystem with a clock
+     ahead of ours reports, would be read anew on every listing */
+  if (l->listed < mtime)
+    LOG_MSG ("node_listing_get: Directory changed %ld s in the future; "
+	     "its listing cannot be cached.", (long) (mtime - l->listed));
+
+  /*replace the old listing */
+  node_listing_drop (dir);
+  dir->nn->listing = l;
+  *listing = l;
+
+  /*account for the new listing */
+  mutex_lock (&node_listings_lock);
+  dir->nn->listing_next = node_listings_mru;
+  if (node_listings_mru)
+    node_listings_mru->nn->listing_prev = dir;
   else
-    /*store the list of dirents in the second parameter */
-    *dirents = node_dirent_list;
+    node_listings_lru = dir;
+  node_listings_mru = dir;
+  __sync_fetch_and_add (&node_listing_memory, l->memory);
+  mutex_unlock (&node_listings_lock);
 
-  /*Free the list of pointers to dirent */
-  free (dirent_list);
+  return 0;
+}				/*node_listing_get */
 
-  /*Free the results of listing the dirents */
-  munmap (dirent_data, dirent_data_size);
+/*---------------------------------------------------------------------------*/
+/*Changes the number of bytes occupied by the listing `l` by `delta`*/
+static void node_listing_account (node_listing_t * l, long delta)
+{
+  l->memory += delta;
+  __sync_fetch_and_add (&node_listing_memory, delta);
+}				/*node_listing_account */
+
+/*---------------------------------------------------------------------------*/
+/*Reads the chunk number `chunk` of the listing of the locked `dir` into
+  the least recently used segment, which is stored in `segment`. The
+  chunks must be read for the first time in their order*/
+static error_t node_listing_load (node_t * dir, int chunk,
+				  node_listing_segment_t ** segment)
+{
+  error_t err;
+
+  /*The listing and the segment to reuse */
+  node_listing_t *l = dir->nn->listing;
+  node_listing_segment_t *s, *victim = l->segments;
+
+  /*The result of dir_readdir and the number of entries in it */
+  char *data;
+  size_t data_size;
+  int entries_num, entries_read;
+
+  /*The current entry, the next one and the end of the entries */
+  struct dirent *dp, *next;
+  char *end;
+
+  /*The grown index of the chunks and the index of the entries */
+  int *chunk_first;
+  size_t *offsets;
+
+  /*The port of the directory may have been given up */
+  err = node_port_ensure (dir);
+  if (err)
+    return err;
+
+  /*Make room for the index of a new chunk */
+  if (chunk == l->chunks)
+    {
+      chunk_first = realloc (l->chunk_first, (l->chunks + 2) * sizeof (int));
+      if (!chunk_first)
+	return ENOMEM;
+      l->chunk_first = chunk_first;
+    }
+
+  /*Read the chunk from the underlying directory */
+  __sync_fetch_and_add (&node_listing_reads, 1);
+  err = dir_readdir (dir->nn->port, &data, &data_size,
+		     chunk * NODE_LISTING_CHUNK, NODE_LISTING_CHUNK, 0,
+		     &entries_num);
+  if (err)
+    return err;
+  entries_read = entries_num;
+
+  /*Make room for the offsets of the entries */
+  offsets = malloc ((entries_num + 1) * sizeof (size_t));
+  if (!offsets)
+    {
+      munmap (data, data_size);
+      return ENOMEM;
+    }
+
+  /*Reuse an empty segment or the one used the longest time ago */
+  for (s = l->segments; s < l->segments + NODE_LISTING_SEGMENTS; ++s)
+    if ((s->chunk < 0) || ((victim->chunk >= 0) && (s->used < victim->used)))
+      victim = s;
+  if (victim->chunk >= 0)
+    {
+      munmap (victim->buffer, victim->buffer_size);
+      free (victim->offsets);
+      node_listing_account (l, -(long) (victim->buffer_size
+				       + (victim->count + 1)
+				       * sizeof (size_t)));
+    }
+
+  /*Keep the buffer of dir_readdir, splicing '.' and '..' out of it:
+     they normally come first, so the entries just start after them;
+     anywhere else, the entries behind them are moved over them */
+  victim->chunk = chunk;
+  victim->used = ++l->clock;
+  victim->buffer = victim->data = data;
+  victim->buffer_size = data_size;
+  victim->count = 0;
+  victim->offsets = offsets;
+  for (dp = (struct dirent *) data, end = data;
+       (victim->count < entries_num) && ((char *) dp < data + data_size)
+       && (dp->d_reclen > 0); dp = next)
+    {
+      next = NODE_LISTING_NEXT (dp);
+
+      if (strcmp (dp->d_name, ".") && strcmp (dp->d_name, ".."))
+	{
+	  offsets[victim->count++] = (char *) dp - victim->data;
+	  end = (char *) next;
+	}
+      else
+	{
+	  --entries_num;
+	  if ((char *) dp == victim->data)
+	    victim->data = end = (char *) next;
+	  else
+	    {
+	      data_size -= dp->d_reclen;
+	      memmove (dp, next, data + data_size - (char *) dp);
+	      next = dp;
+	    }
+	}
+    }
+  victim->size = end - victim->data;
+  offsets[victim->count] = victim->size;
+
+  /*A chunk read again must hold as many entries as it did the first
+     time, or the index of the chunks is wrong; the directory has
+     changed under the listing, so make sure that the next
+     node_listing_get starts it anew */
+  if ((chunk < l->chunks)
+      && (victim->count != l->chunk_first[chunk + 1]
+	  - l->chunk_first[chunk]))
+    {
+      munmap (victim->buffer, victim->buffer_size);
+      free (victim->offsets);
+      victim->chunk = -1;
+      l->listed = 0;
+      return ESTALE;
+    }
+
+  node_listing_account (l, victim->buffer_size
+			+ (victim->count + 1) * sizeof (size_t));
+
+  /*A chunk read for the first time extends the index */
+  if (chunk == l->chunks)
+    {
+      l->chunk_first[chunk + 1] = l->chunk_first[chunk] + victim->count;
+      l->count += victim->count;
+      l->size += victim->size;
+      l->complete = (entries_read < NODE_LISTING_CHUNK);
+      ++l->chunks;
+      node_listing_account (l, sizeof (int));
+    }
+
+  *segment = victim;
+  return 0;
+}				/*node_listing_load */
+
+/*---------------------------------------------------------------------------*/
+/*Stores in `segment` the chunk number `chunk` of the listing of the
+  locked `dir`, reading it if it is not in memory, or NULL if the
+  directory ends before it. Returns ESTALE if the chunk had to be read
+  again and the directory has changed meanwhile; the listing must then
+  be obtained anew*/
+error_t node_listing_chunk (node_t * dir, int chunk,
+			    node_listing_segment_t ** segment)
+{
+  error_t err = 0;
+
+  /*The listing and the segment being examined */
+  node_listing_t *l = dir->nn->listing;
+  node_listing_segment_t *s;
+
+  /*The chunks are read for the first time in their order */
+  while (!err && (chunk >= l->chunks) && !l->complete)
+    err = node_listing_load (dir, l->chunks, segment);
+  if (err)
+    return err;
+
+  *segment = NULL;
+  if (chunk >= l->chunks)
+    return 0;
+
+  /*The chunk may still be in memory */
+  for (s = l->segments; s < l->segments + NODE_LISTING_SEGMENTS; ++s)
+    if (s->chunk == chunk)
+      {
+	s->used = ++l->clock;
+	*segment = s;
+	return 0;
+      }
+
+  /*Read the chunk again */
+  return node_listing_load (dir, chunk, segment);
+}				/*node_listing_chunk */
+
+/*---------------------------------------------------------------------------*/
+/*Stores in `segment` the chunk of the listing of the locked `dir` which
+  holds the entry number `entry` (not counting '.' and '..') and in
+  `index` the number of the entry in the chunk, or NULL in `segment` if
+  there is no such entry*/
+error_t node_listing_entry (node_t * dir, int entry,
+			    node_listing_segment_t ** segment, int *index)
+{
+  error_t err = 0;
+
+  /*The listing */
+  node_listing_t *l = dir->nn->listing;
+
+  /*The bounds of the search for the chunk */
+  int lo, hi, mid;
+
+  /*Read the directory as far as the entry */
+  while (!err && (entry >= l->count) && !l->complete)
+    err = node_listing_chunk (dir, l->chunks, segment);
+
+  *segment = NULL;
+  if (err || (entry >= l->count))
+    return err;
+
+  /*Find the last chunk starting not after the entry */
+  for (lo = 0, hi = l->chunks - 1; lo < hi;)
+    {
+      mid = (lo + hi + 1) / 2;
+      if (l->chunk_first[mid] <= entry)
+	lo = mid;
+      else
+	hi = mid - 1;
+    }
+
+  *index = entry - l->chunk_first[lo];
+  err = node_listing_chunk (dir, lo, segment);
+
+  /*The index must agree with the chunk read */
+  if (!err && *segment && (*index >= (*segment)->count))
+    {
+      *segment = NULL;
+      l->listed = 0;
+      err = ESTALE;
+    }
 
-  /*Return the result of operations */
   return err;
-}				/*node_entries_get */
+}				/*node_listing_entry */
 
 /*---------------------------------------------------------------------------*/
 /*Makes sure that all ports to the underlying filesystem of `node` are
@@ -578,7 +1462,9 @@ error_t node_update (node_t * node)
   if (err)
     {
       node->nn->port = MACH_PORT_NULL;
+      node->nn->flags &= ~FLAG_NODE_PORT_RELEASED;
       err = 0;			/*failure (?) */
+      mutex_unlock (&netfs_root_node->lock);
       return err;
     }
 
@@ -605,11 +1491,17 @@ error_t node_update (node_t * node)
   /*Store the port in the node */
   node->nn->port = port;
 
+  /*The stat information may describe a different file now */
+  node_stat_invalidate (node);
+
   /*Remove the flag about the invalidity of the current node and set the
      flag that the node is up-to-date */
-  node->nn->flags &= ~FLAG_NODE_INVALIDATE;
+  node->nn->flags &= ~(FLAG_NODE_INVALIDATE | FLAG_NODE_PORT_RELEASED);
   node->nn->flags |= FLAG_NODE_ULFS_UPTODATE;
 
+  /*Let the pool account for the new port */
+  node_port_pool_add (node);
+
   /*Release the lock on the root node of proxy filesystem */
   mutex_unlock (&netfs_root_node->lock);
 
@@ -623,69 +1515,42 @@ error_t node_get_size (node_t * dir, OFFSET_T * off)
 {
   error_t err = 0;
 
-  /*The final size */
-  size_t size = 0;
-
-  /*The number of directory entries */
-  /*int count = 0; */
+  /*The listing of the directory */
+  node_listing_t *listing;
 
-  /*The the node in the directory entries list from which we start counting */
-  /*node_dirent_t * dirent_start = NULL; */
+  /*The current chunk */
+  node_listing_segment_t *segment;
 
-  /*The currently analyzed dirent */
-  node_dirent_t *dirent_current = NULL;
-
-  /*The pointer to the beginning of the list of dirents */
-  node_dirent_t *dirent_list = NULL;
-
-  /*The first entry we have to analyze */
-  /*int first_entry = 2; */
-
-  /*Takes into consideration the name of the current dirent */
-  void bump_size (const char *name)
-  {
-    /*Increment the current size by the size of the current dirent */
-    size += DIRENT_LEN (strlen (name));
+  /*Obtain the entries in the current directory; '.' and '..' are not
+     taken into account, as always */
+  err = node_listing_get (dir, &listing);
+  if (err)
+    return err;
 
-    /*Count the current dirent */
-    /*++count; */
-  }				/*bump_size */
+  /*The listing checks the times of the directory, so the size computed
+     before is still right if the directory has not changed since; it
+     is kept even if the listing has been dropped in the meantime */
+  if ((dir->nn->dir_size_listed != 0)
+      && (dir->nn->dir_size_mtime == listing->mtime)
+      && (dir->nn->dir_size_ctime == listing->ctime)
+      && (dir->nn->dir_size_listed > listing->mtime))
+    {
+      *off = dir->nn->dir_size;
+      return 0;
+    }
 
-  /*Obtain the list of entries in the current directory */
-  err = node_entries_get (dir, &dirent_list);
+  /*Read the rest of the directory; only the last chunks stay in
+     memory */
+  while (!err && !listing->complete)
+    err = node_listing_chunk (dir, listing->chunks, &segment);
   if (err)
     return err;
 
-  /*Obtain the pointer to the dirent which has the number first_entry */
-  /*Actually, the first element of the list */
-  /*This code is included in unionfs, but it's completely useless here */
-  /*for
-     (
-     dirent_start = dirent_list, count = 2;
-     dirent_start && count < first_entry;
-     dirent_start = dirent_start->next, ++count
-     ); */
-
-  /*Reset the count */
-  /*count = 0; */
-
-  /*Make space for '.' and '..' entries */
-  /*This code is included in unionfs, but it's completely useless here */
-  /*if(first_entry == 0)
-     bump_size(".");
-     if(first_entry <= 1)
-     bump_size(".."); */
-
-  /*See how much space is required for the node */
-  for (dirent_current = dirent_list /*dirent_start */ ; dirent_current;
-       dirent_current = dirent_current->next)
-    bump_size (dirent_current->dirent->d_name);
-
-  /*Free the list of dirents */
-  node_entries_free (dirent_list);
-
-  /*Return the size */
-  *off = size;
+  /*The entries are packed, so their total size is the size needed */
+  dir->nn->dir_size = *off = listing->size;
+  dir->nn->dir_size_mtime = listing->mtime;
+  dir->nn->dir_size_ctime = listing->ctime;
+  dir->nn->dir_size_listed = listing->listed;
   return 0;
 }				/*node_get_size */
 
@@ -701,6 +1566,9 @@ error_t node_unlink_file (node_t * dir, char *name)
   /*Stat information about the file which will be unlinked */
   io_statbuf_t stat;
 
+  /*The port of the directory may have been given up */
+  node_port_ensure (dir);
+
   /*If port corresponding to `dir` is invalid */
   if (dir->nn->port == MACH_PORT_NULL)
     /*stop with an error */
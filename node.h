@@ -32,6 +32,7 @@
 #include <hurd/netfs.h>
 /*---------------------------------------------------------------------------*/
 #include "lnode.h"
+#include "slab.h"
 #include "trans.h"
 /*---------------------------------------------------------------------------*/
 
@@ -44,6 +45,55 @@
 #define FLAG_NODE_ULFS_FIXED    0x00000001 /*this node should not be updated */
 #define FLAG_NODE_INVALIDATE    0x00000002 /*this node must be updated */
 #define FLAG_NODE_ULFS_UPTODATE	0x00000004 /*this node has just been updated */
+#define FLAG_NODE_REFRESHING    0x00000008 /*the stat information of this
+					     node is being refreshed */
+#define FLAG_NODE_PORT_RELEASED 0x00000010 /*the port of this node has
+					     been given up and must be
+					     reopened before use */
+/*---------------------------------------------------------------------------*/
+/*The default time in milliseconds for which the stat information of a
+  node is trusted without asking the underlying filesystem*/
+#define NODE_STAT_TTL 1000
+/*---------------------------------------------------------------------------*/
+/*The default time in milliseconds for which stale stat information is
+  still returned while it is being refreshed in the background (not
+  more than NODE_STAT_TTL disables the background refreshing)*/
+#define NODE_STAT_HARD_TTL 0
+/*---------------------------------------------------------------------------*/
+/*The default maximal number of nodes keeping ports to the underlying
+  filesystem on behalf of the port pool*/
+#define NODE_PORTS_MAX 512
+/*---------------------------------------------------------------------------*/
+/*The port used to stat the file behind `np`: directories keep their
+  own port, other files may keep a port just for that*/
+#define NODE_STAT_PORT(np)\
+	(((np)->nn->port != MACH_PORT_NULL) ? ((np)->nn->port)\
+	 : ((np)->nn->stat_port))
+/*---------------------------------------------------------------------------*/
+/*The entry following `dp` in a listing of a directory*/
+#define NODE_LISTING_NEXT(dp)\
+	((struct dirent *) ((char *) (dp) + (dp)->d_reclen))
+/*---------------------------------------------------------------------------*/
+/*The entry number `i` of the chunk of a listing kept in `segment`*/
+#define NODE_LISTING_ENTRY(segment, i)\
+	((struct dirent *) ((segment)->data + (segment)->offsets[i]))
+/*---------------------------------------------------------------------------*/
+/*The total size of the entries from number `i` to number `j` (not
+  included) of the chunk of a listing kept in `segment`*/
+#define NODE_LISTING_SPAN(segment, i, j)\
+	((segment)->offsets[j] - (segment)->offsets[i])
+/*---------------------------------------------------------------------------*/
+/*The number of entries read from an underlying directory at once*/
+#define NODE_LISTING_CHUNK 256
+/*---------------------------------------------------------------------------*/
+/*The number of chunks of a listing kept in memory at once; the others
+  are read again when needed*/
+#define NODE_LISTING_SEGMENTS 8
+/*---------------------------------------------------------------------------*/
+/*The maximal number of chunks returned in a single reply to
+  dir_readdir (less than NODE_LISTING_SEGMENTS); the client asks again
+  for the rest*/
+#define NODE_LISTING_REPLY_CHUNKS 4
 /*---------------------------------------------------------------------------*/
 /*Types of nodes */
 #define NODE_TYPE_NORMAL	0
@@ -60,6 +110,66 @@
 
 /*---------------------------------------------------------------------------*/
 /*--------Types--------------------------------------------------------------*/
+/*A chunk of a listing of a directory kept in memory: the buffer
+  returned by dir_readdir for NODE_LISTING_CHUNK entries, with '.' and
+  '..' spliced out, so that the entries lie one after another in the
+  format of dir_readdir*/
+struct node_listing_segment
+{
+  /*the number of the chunk (-1 if the segment is empty) */
+  int chunk;
+
+  /*the time the segment was last used, to choose the one to replace */
+  unsigned long used;
+
+  /*the buffer returned by dir_readdir and its size */
+  char *buffer;
+  size_t buffer_size;
+
+  /*the entries, inside `buffer`, their total size and their number */
+  char *data;
+  size_t size;
+  int count;
+
+  /*the offset of every entry from `data`, in the order of the
+     underlying directory, followed by `size` */
+  size_t *offsets;
+};				/*struct node_listing_segment */
+/*---------------------------------------------------------------------------*/
+typedef struct node_listing_segment node_listing_segment_t;
+/*---------------------------------------------------------------------------*/
+/*A listing of a directory cached in its netnode. The underlying
+  directory is read in chunks of NODE_LISTING_CHUNK entries, as far as
+  needed, and only the last NODE_LISTING_SEGMENTS chunks used are kept,
+  so the memory of a listing does not grow with the directory*/
+struct node_listing
+{
+  /*the modification and status change times of the directory when it
+     was listed, and the time of the listing itself (in seconds) */
+  time_t mtime, ctime, listed;
+
+  /*the number of chunks read so far and whether the last one has been
+     read */
+  int chunks, complete;
+
+  /*the number of the first entry of every chunk read so far (not
+     counting '.' and '..'), followed by the number of entries in them */
+  int *chunk_first;
+
+  /*the number and the total size of the entries read so far */
+  int count;
+  size_t size;
+
+  /*the chunks in memory and the counter of their uses */
+  node_listing_segment_t segments[NODE_LISTING_SEGMENTS];
+  unsigned long clock;
+
+  /*the number of bytes the listing occupies */
+  size_t memory;
+};				/*struct node_listing */
+/*---------------------------------------------------------------------------*/
+typedef struct node_listing node_listing_t;
+/*---------------------------------------------------------------------------*/
 /*The user-defined node for libnetfs*/
 struct netnode
 {
@@ -75,6 +185,38 @@ struct netnode
   /*a port to the underlying filesystem */
   file_t port;
 
+  /*a port kept only to stat a file which is not a directory, and the
+     time (in milliseconds) at which it was opened */
+  file_t stat_port;
+  unsigned long stat_port_time;
+
+  /*the neighbouring entries in the pool of open ports and whether the
+     node is in the pool (see node_port_pool_add) */
+  node_t *port_prev, *port_next;
+  int port_pooled;
+
+  /*the time (in milliseconds) at which `nn_stat` of the node was
+     fetched from the underlying filesystem (0 if it must be fetched
+     anew), and the number of times it has been invalidated, which
+     tells a refresh started before an invalidation to discard its
+     result */
+  unsigned long stat_time;
+  unsigned int stat_gen;
+
+  /*the next node whose stat information is waiting to be refreshed */
+  node_t *refresh_next;
+
+  /*the cached listing of the directory, if any, and the neighbouring
+     nodes in the list of cached listings */
+  node_listing_t *listing;
+  node_t *listing_prev, *listing_next;
+
+  /*the total size of the entries of the directory, which outlives the
+     listing it was computed from, and the times of that listing
+     (`dir_size_listed` is 0 if the size is unknown) */
+  OFFSET_T dir_size;
+  time_t dir_size_mtime, dir_size_ctime, dir_size_listed;
+
   /*a reference to the element in the list of dynamic translators
     corresponding to the translator sitting on this node, in case this
     node is a shadow node */
@@ -86,34 +228,117 @@ struct netnode
 
   /*the neighbouring entries in the cache */
   node_t *ncache_prev, *ncache_next;
+
+  /*the queue of the cache shard the node is kept in and whether the
+     node has been used since the replacement policy last looked at
+     it (see ncache.{c,h}) */
+  int ncache_queue, ncache_referenced;
+
+  /*set while the node is in the cache; may be read without locking
+     the cache, to decide whether a use of the node is a hit */
+  volatile int ncache_resident;
+
+  /*the next proxy of the same lnode and the pointer to this node from
+     the previous one (see `proxies` in struct lnode) */
+  node_t *proxy_next, **proxy_prevp;
 };				/*struct netnode */
 /*---------------------------------------------------------------------------*/
 typedef struct netnode netnode_t;
 /*---------------------------------------------------------------------------*/
-/*A list element containing directory entry*/
-struct node_dirent
-{
-  /*the directory entry */
-  struct dirent *dirent;
-
-  /*the next element */
-  struct node_dirent *next;
-};				/*struct node_dirent */
-/*---------------------------------------------------------------------------*/
-typedef struct node_dirent node_dirent_t;
-/*---------------------------------------------------------------------------*/
 
 /*---------------------------------------------------------------------------*/
 /*--------Global Variables---------------------------------------------------*/
 /*The lock protecting the underlying filesystem*/
 extern struct mutex ulfs_lock;
 /*---------------------------------------------------------------------------*/
+/*The allocator of netnodes*/
+extern slab_t netnode_slab;
+/*---------------------------------------------------------------------------*/
+/*The time in milliseconds for which the stat information of a node is
+  trusted (0 disables the caching of stat information)*/
+extern int node_stat_ttl;
+/*---------------------------------------------------------------------------*/
+/*The time in milliseconds for which stale stat information is returned
+  while being refreshed in the background*/
+extern int node_stat_hard_ttl;
+/*---------------------------------------------------------------------------*/
+/*The maximal number of nodes keeping ports in the port pool (0 means
+  that only directories keep ports, without a limit)*/
+extern int node_ports_max;
+/*---------------------------------------------------------------------------*/
+/*The number of nodes in the port pool, the number of ports given up to
+  keep within the limit and the number of ports reopened later*/
+extern unsigned long node_ports_count, node_ports_released,
+  node_ports_reopened;
+/*---------------------------------------------------------------------------*/
+/*The number of listings of directories served from memory and the
+  number of times the underlying directory had to be read*/
+extern unsigned long node_listing_hits, node_listing_reads;
+/*---------------------------------------------------------------------------*/
+/*The number of bytes occupied by the cached listings*/
+extern unsigned long node_listing_memory;
+/*---------------------------------------------------------------------------*/
+/*The number of validations of stat information served from memory and
+  the number of io_stat calls they issued; the number of refreshes done
+  in the background*/
+extern unsigned long node_stat_hits, node_stat_rpcs, node_stat_refreshes;
+/*---------------------------------------------------------------------------*/
 
 /*----------------------------------------------------------------------------*/
 /*--------Functions----------------------------------------------------------*/
 /*Derives a new node from `lnode` and adds a reference to `lnode`*/
 error_t node_create (lnode_t * lnode, node_t ** node);
 /*---------------------------------------------------------------------------*/
+/*Checks whether the stat information of `node` may be used without
+  asking the underlying filesystem*/
+int node_stat_fresh (node_t * node);
+/*---------------------------------------------------------------------------*/
+/*Remarks that the stat information of `node` has just been fetched from
+  the underlying filesystem*/
+void node_stat_fetched (node_t * node);
+/*---------------------------------------------------------------------------*/
+/*Forces the stat information of `node` to be fetched anew, also
+  discarding any refresh under way*/
+void node_stat_invalidate (node_t * node);
+/*---------------------------------------------------------------------------*/
+/*Checks whether the stat information of `node` is stale, but may still
+  be returned while it is being refreshed in the background*/
+int node_stat_usable (node_t * node);
+/*---------------------------------------------------------------------------*/
+/*Gives up the port kept for the stat of the locked `node` once it has
+  been kept for longer than stat information may be served, so that the
+  name is looked up again and a file replaced meanwhile is noticed*/
+void node_stat_port_expire (node_t * node);
+/*---------------------------------------------------------------------------*/
+/*Obtains the stat information of the file behind the node with `lnode`
+  and `port` (MACH_PORT_NULL if the node keeps no port) into `stat`. If
+  `opened` is not NULL, the port opened for a node without one is
+  stored there instead of being deallocated*/
+error_t node_stat_obtain (lnode_t * lnode, mach_port_t port,
+			  io_statbuf_t * stat, mach_port_t * opened);
+/*---------------------------------------------------------------------------*/
+/*Puts the locked `node`, which has just opened or used a port, at the
+  MRU end of the port pool and gives up the ports of the least recently
+  used nodes beyond the limit*/
+void node_port_pool_add (node_t * node);
+/*---------------------------------------------------------------------------*/
+/*Removes the locked `node` from the port pool, keeping its ports*/
+void node_port_pool_remove (node_t * node);
+/*---------------------------------------------------------------------------*/
+/*Gives up the ports of the least recently used nodes while the port
+  pool holds more nodes than allowed*/
+void node_port_pool_trim (void);
+/*---------------------------------------------------------------------------*/
+/*Reopens the port of the locked `node` if it has been given up*/
+error_t node_port_ensure (node_t * node);
+/*---------------------------------------------------------------------------*/
+/*Queues the stat information of the locked `node` for a refresh in the
+  background, unless it is already queued*/
+void node_stat_refresh_queue (node_t * node);
+/*---------------------------------------------------------------------------*/
+/*Starts the thread which refreshes the queued stat information*/
+void node_stat_refresh_init (void);
+/*---------------------------------------------------------------------------*/
 /*Derives a new proxy from `lnode`*/
 error_t node_create_proxy (lnode_t * lnode, node_t ** node);
 /*---------------------------------------------------------------------------*/
@@ -121,7 +346,8 @@ error_t node_create_proxy (lnode_t * lnode, node_t ** node);
 error_t node_create_from_port (mach_port_t port, node_t ** node);
 /*---------------------------------------------------------------------------*/
 /*Destroys the specified node and removes a light reference from the
-  associated light node*/
+  associated light node. Must be called with netfs_node_refcnt_lock
+  held, which is released for a while*/
 void node_destroy (node_t * np);
 /*---------------------------------------------------------------------------*/
 /*Creates the root node and the corresponding lnode*/
@@ -130,11 +356,34 @@ error_t node_create_root (node_t ** root_node);
 /*Initializes the port to the underlying filesystem for the root node*/
 error_t node_init_root (node_t * node);
 /*---------------------------------------------------------------------------*/
-/*Frees a list of dirents*/
-void node_entries_free (node_dirent_t * dirents);
-/*---------------------------------------------------------------------------*/
-/*Reads the directory entries from `node`, which must be locked*/
-error_t node_entries_get (node_t * node, node_dirent_t ** dirents);
+/*Stores in `listing` the listing of the locked directory `dir`, which
+  is started anew only if the directory has changed since the cached
+  listing was started. The listing belongs to `dir` and stays valid
+  while `dir` is locked*/
+error_t node_listing_get (node_t * dir, node_listing_t ** listing);
+/*---------------------------------------------------------------------------*/
+/*Drops the cached listing of the locked `dir`*/
+void node_listing_drop (node_t * dir);
+/*---------------------------------------------------------------------------*/
+/*Stores in `segment` the chunk number `chunk` of the listing of the
+  locked `dir`, reading it if it is not in memory, or NULL if the
+  directory ends before it. Returns ESTALE if the chunk had to be read
+  again and the directory has changed meanwhile; the listing must then
+  be obtained anew*/
+error_t node_listing_chunk (node_t * dir, int chunk,
+			    node_listing_segment_t ** segment);
+/*---------------------------------------------------------------------------*/
+/*Stores in `segment` the chunk of the listing of the locked `dir` which
+  holds the entry number `entry` (not counting '.' and '..') and in
+  `index` the number of the entry in the chunk, or NULL in `segment` if
+  there is no such entry*/
+error_t node_listing_entry (node_t * dir, int entry,
+			    node_listing_segment_t ** segment, int *index);
+/*---------------------------------------------------------------------------*/
+/*Drops the oldest cached listings until they occupy at most `limit`
+  bytes; the listings of directories which are locked at the moment are
+  skipped*/
+void node_listing_trim (unsigned long limit);
 /*---------------------------------------------------------------------------*/
 /*Makes sure that all ports to the underlying filesystem of `node` are
   up to date*/
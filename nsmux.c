@@ -40,6 +40,8 @@
 #include "options.h"
 #include "ncache.h"
 #include "magic.h"
+#include "snapshot.h"
+#include "memory.h"
 /*---------------------------------------------------------------------------*/
 
 /*---------------------------------------------------------------------------*/
@@ -68,6 +70,9 @@ pid_t fsid;
 /*The file to print debug messages to*/
 FILE *nsmux_dbg;
 /*---------------------------------------------------------------------------*/
+/*The parser of the options given through fsysopts*/
+struct argp *netfs_runtime_argp = &argp_runtime;
+/*---------------------------------------------------------------------------*/
 
 /*---------------------------------------------------------------------------*/
 /*--------Functions----------------------------------------------------------*/
@@ -181,65 +186,79 @@ error_t netfs_validate_stat (struct node * np, struct iouser * cred)
 	  /*update it */
 	  err = node_update (np);
 	}
+      /*If the stat information has been fetched recently, trust it */
+      else if (node_stat_fresh (np))
+	{
+	  __sync_fetch_and_add (&node_stat_hits, 1);
+	  return 0;
+	}
+      /*If the stat information is stale, but still acceptable, return
+         it at once and let it be refreshed in the background */
+      else if (node_stat_usable (np))
+	{
+	  __sync_fetch_and_add (&node_stat_hits, 1);
+	  node_stat_refresh_queue (np);
+	  return 0;
+	}
 
       /*If no errors have yet occurred */
       if (!err)
 	{
-	  /*If the port to the file corresponding to `np` is valid */
-	  if (np->nn->port != MACH_PORT_NULL)
-	    {
-	      /*We have a directory here (normally, only they maintain an open port).
-	         Generally, our only concern is to maintain an open port in this case */
-
-	      /*attempt to stat this file */
-	      err = io_stat (np->nn->port, &np->nn_stat);
-
-	      if (S_ISDIR (np->nn_stat.st_mode))
-		LOG_MSG ("\tIs a directory");
-
-	      /*If stat information has been successfully obtained for the file */
-	      if (!err)
-		/*duplicate the st_mode field of stat structure */
-		np->nn_translated = np->nn_stat.st_mode;
-	    }
-	  else
-	    {
-	      /*We, most probably, have something which is not a
-	         directory. Therefore we will open the port and close
-	         it after the stat, so that additional resources are
-	         not consumed. */
-
-	      /*the parent node of the current node */
-	      node_t *dnp;
-
-	      /*obtain the parent node of the the current node */
-	      err = ncache_node_lookup (np->nn->lnode->dir, &dnp);
+	  __sync_fetch_and_add (&node_stat_rpcs, 1);
 
-	      /*the lookup should never fail here */
-	      assert (!err);
+	  /*The port opened for a file which kept none */
+	  mach_port_t opened;
 
-	      /*open a port to the file we are interested in */
-	      mach_port_t p = file_name_lookup_under
-		(dnp->nn->port, np->nn->lnode->name, 0, 0);
+	  /*a port kept for too long is not trusted to still name the
+	     file, which may have been replaced */
+	  node_stat_port_expire (np);
 
-	      /*put `dnp` back, since we don't need it any more */
-	      netfs_nput (dnp);
+	  /*ask the underlying filesystem */
+	  err = node_stat_obtain
+	    (np->nn->lnode, NODE_STAT_PORT (np), &np->nn_stat, &opened);
 
-	      if (!p)
-		return EBADF;
+	  /*If stat information has been successfully obtained for the file */
+	  if (!err)
+	    {
+	      /*We have a directory here (normally, only they maintain
+	         an open port); duplicate the st_mode field of stat
+	         structure */
+	      if (np->nn->port != MACH_PORT_NULL)
+		np->nn_translated = np->nn_stat.st_mode;
 
-	      /*try to stat the node */
-	      err = io_stat (p, &np->nn_stat);
+	      /*remember when the information was obtained */
+	      node_stat_fetched (np);
 
-	      /*deallocate the port */
-	      PORT_DEALLOC (p);
+	      /*keep the port for the next stat, if the pool wants it */
+	      if (opened != MACH_PORT_NULL)
+		{
+		  np->nn->stat_port = opened;
+		  np->nn->stat_port_time = time_ms ();
+		}
+	      node_port_pool_add (np);
+	    }
+	  /*If the port kept for the stat has gone bad, drop it */
+	  else if (np->nn->stat_port != MACH_PORT_NULL)
+	    {
+	      node_port_pool_remove (np);
+	      PORT_DEALLOC (np->nn->stat_port);
+	      np->nn->stat_port = MACH_PORT_NULL;
 	    }
 	}
     }
-  /*If we are at the root */
+  /*If we are at the root, only the size may change; it is trusted for
+     as long as any other stat information */
+  else if (node_stat_fresh (np))
+    __sync_fetch_and_add (&node_stat_hits, 1);
   else
-    /*put the size of the node into the stat structure belonging to `np` */
-    node_get_size (np, (OFFSET_T *) & np->nn_stat.st_size);
+    {
+      __sync_fetch_and_add (&node_stat_rpcs, 1);
+
+      /*put the size of the node into the stat structure belonging to
+         `np`; it is only computed again if the directory has changed */
+      if (node_get_size (np, (OFFSET_T *) & np->nn_stat.st_size) == 0)
+	node_stat_fetched (np);
+    }
 
   /*Return the result of operations */
   return err;
@@ -272,11 +291,19 @@ error_t
 
   error_t err;
 
-  /*Two pointers required for processing the list of dirents */
-  node_dirent_t *dirent_start, *dirent_current;
+  /*The cached listing of `dir` and the current chunk of it */
+  node_listing_t *listing;
+  node_listing_segment_t *segment;
 
-  /*The pointer to the beginning of the list of dirents */
-  node_dirent_t *dirent_list = NULL;
+  /*The number of the first entry of the current chunk to return, the
+     number of the one after the last and the bounds of the search for
+     the latter */
+  int first, last, lo, hi, mid;
+
+  /*The entries to return from every chunk and the number of chunks */
+  char *span_start[NODE_LISTING_REPLY_CHUNKS];
+  size_t span_size[NODE_LISTING_REPLY_CHUNKS];
+  int spans = 0, i;
 
   /*The size of the current dirent */
   size_t size = 0;
@@ -284,17 +311,20 @@ error_t
   /*The number of dirents added */
   int count = 0;
 
+  /*The number of the first entry of the listing to return */
+  int start = (first_entry > 2) ? (first_entry - 2) : (0);
+
   /*The dereferenced value of parameter `data` */
   char *data_p;
 
-  /*Takes into account the size of the given dirent */
-  int bump_size (const char *name)
+  /*Takes into account a dirent of the given size */
+  int bump_size (size_t reclen)
   {
     /*If the required number of entries has not been listed yet */
     if ((num_entries == -1) || (count < num_entries))
       {
-	/*take the current size and take into account the length of the name */
-	size_t new_size = size + DIRENT_LEN (strlen (name));
+	/*take the current size and take into account the new dirent */
+	size_t new_size = size + reclen;
 
 	/*If there is a limit for the received size and it has been exceeded */
 	if ((max_data_len > 0) && (new_size > max_data_len))
@@ -374,34 +404,79 @@ error_t
   }				/*add_dirent */
 
   /*List the dirents for node `dir` */
-  err = node_entries_get (dir, &dirent_list);
+  err = node_listing_get (dir, &listing);
 
-  /*If listing was successful */
+  /*find the entry whose number is `first_entry` */
   if (!err)
-    {
-      /*find the entry whose number is `first_entry` */
-      for
-	(dirent_start = dirent_list, count = 2;
-	 dirent_start && (count < first_entry);
-	 dirent_start = dirent_start->next, ++count);
+    err = node_listing_entry (dir, start, &segment, &first);
 
-      /*reset number of dirents added so far */
-      count = 0;
+  /*If the directory changed while the chunk was out of memory, list it
+     anew, once */
+  if (err == ESTALE)
+    {
+      err = node_listing_get (dir, &listing);
+      if (!err)
+	err = node_listing_entry (dir, start, &segment, &first);
+    }
 
+  /*If listing was successful */
+  if (!err)
+    {
       /*make space for entries '.' and '..', if required */
       if (first_entry == 0)
-	bump_size (".");
+	bump_size (DIRENT_LEN (1));
       if (first_entry <= 1)
-	bump_size ("..");
+	bump_size (DIRENT_LEN (2));
 
-      /*Go through all dirents */
-      for
-	(dirent_current = dirent_start;
-	 dirent_current; dirent_current = dirent_current->next)
-	/*If another dirent cannot be added succesfully */
-	if (bump_size (dirent_current->dirent->d_name) == 0)
-	  /*stop here */
-	  break;
+      /*Go through the dirents of a few chunks; they are returned as
+         they are, and the client asks again for the rest. The chunks
+         used here are the most recently used ones, so reading the
+         next one does not push them out of memory */
+      while (segment && (spans < NODE_LISTING_REPLY_CHUNKS))
+	{
+	  /*take as many entries as asked for, never reaching outside the
+	     chunk nor going backwards ('.' and '..' may already have
+	     taken all the entries asked for) */
+	  if (first > segment->count)
+	    first = segment->count;
+	  last = segment->count;
+	  if ((num_entries != -1) && (last - first > num_entries - count))
+	    last = first + num_entries - count;
+	  if (last < first)
+	    last = first;
+
+	  /*and as many of them as fit, knowing the size of any run of
+	     entries from their offsets */
+	  if (max_data_len > 0)
+	    {
+	      for (lo = first, hi = last; lo < hi;)
+		{
+		  mid = (lo + hi + 1) / 2;
+		  if (size + NODE_LISTING_SPAN (segment, first, mid)
+		      <= max_data_len)
+		    lo = mid;
+		  else
+		    hi = mid - 1;
+		}
+	      last = lo;
+	    }
+
+	  span_start[spans] = (char *) NODE_LISTING_ENTRY (segment, first);
+	  span_size[spans++] = NODE_LISTING_SPAN (segment, first, last);
+	  size += NODE_LISTING_SPAN (segment, first, last);
+	  count += last - first;
+
+	  /*If the reply is full, stop here */
+	  if ((last < segment->count)
+	      || ((num_entries != -1) && (count >= num_entries)))
+	    break;
+
+	  /*go on with the next chunk; if it cannot be read, return what
+	     is there, the client will get the error when it asks again */
+	  if (node_listing_chunk (dir, segment->chunk + 1, &segment))
+	    break;
+	  first = 0;
+	}
 
       /*allocate the required space for dirents */
       *data = mmap (0, size, PROT_READ | PROT_WRITE, MAP_ANON, 0, 0);
@@ -429,22 +504,15 @@ error_t
       if (first_entry <= 1)
 	add_dirent ("..", 2, DT_DIR);
 
-      /*Follow the list of dirents beginning with dirents_start */
-      for
-	(dirent_current = dirent_start; dirent_current;
-	 dirent_current = dirent_current->next)
-	/*If the addition of the current dirent fails */
-	if (add_dirent
-	    (dirent_current->dirent->d_name, dirent_current->dirent->d_fileno,
-	     dirent_current->dirent->d_type) == 0)
-	  /*stop adding dirents */
-	  break;
+      /*The chosen entries of every chunk lie one after another, in
+         the format of dir_readdir, so copy them all at once */
+      for (i = 0; i < spans; ++i)
+	{
+	  memcpy (data_p, span_start[i], span_size[i]);
+	  data_p += span_size[i];
+	}
     }
 
-  /*If the list of dirents has been allocated, free it */
-  if (dirent_list)
-    node_entries_free (dirent_list);
-
   /*The directory has been read right now, modify the access time */
   fshelp_touch (&dir->nn_stat, TOUCH_ATIME, maptime);
 
@@ -551,7 +619,7 @@ error_t
     }
 
   /*The port to the requested file */
-  mach_port_t p;
+  mach_port_t p = MACH_PORT_NULL;
 
   /*The lnode corresponding to the entry we are supposed to fetch */
   lnode_t *lnode;
@@ -559,9 +627,31 @@ error_t
   /*Is the looked up file a directory */
   int isdir;
 
+  /*The port of `dir` may have been given up to the port pool; if it
+     cannot be reopened, looking up under a null port would only fail
+     obscurely (and could be remembered as a negative entry) */
+  err = node_port_ensure (dir);
+  if (err)
+    {
+      mutex_unlock (&dir->lock);
+      *node = NULL;
+      return err;
+    }
+
+  /*The lnode of `dir`, the port to the underlying directory and its
+     modification time; copied, so that `dir` needs not stay locked
+     during the RPCs to the underlying filesystem */
+  lnode_t *dir_lnode = dir->nn->lnode;
+  mach_port_t dir_port = dir->nn->port;
+  time_t dir_mtime = dir->nn_stat.st_mtime;
+
   /*Finalizes the execution of this function */
   void finalize (void)
   {
+    /*Drop our right to the port of `dir` */
+    if (dir_port != MACH_PORT_NULL)
+      PORT_DEALLOC (dir_port);
+
     /*If some errors have occurred */
     if (err)
       {
@@ -581,10 +671,6 @@ error_t
 	/*add the node to the cache */
 	ncache_node_add (*node);
       }
-
-    /*Unlock the mutexes in `dir` */
-    mutex_unlock (&dir->nn->lnode->lock);
-    mutex_unlock (&dir->lock);
   }				/*finalize */
 
   /*Performs a usual lookup */
@@ -593,82 +679,150 @@ error_t
 		  int proxy	/*should a proxy node be created */
     )
   {
-    /*Try to lookup the given file in the underlying directory */
-    p = file_name_lookup_under (dir->nn->port, name, 0, 0);
-
-    /*If the lookup failed */
-    if (p == MACH_PORT_NULL)
-      /*no such entry */
-      return ENOENT;
+    /*Has `name` recently been found not to exist in `dir`? */
+    int negative = 0;
 
-    /*Obtain the stat information about the file */
+    /*The stat information of the file and whether it can be trusted */
     io_statbuf_t stat;
-    err = io_stat (p, &stat);
+    int stat_valid = 0;
 
-    /*Deallocate the obtained port */
-    PORT_DEALLOC (p);
+    /*If `dir` has any negative entries, look for `name` among them; do
+       not lock the lnode of `dir` otherwise */
+    if (dir_lnode->negatives)
+      {
+	mutex_lock (&dir_lnode->lock);
+	negative = lnode_negative_lookup (dir_lnode, name, dir_mtime);
+	mutex_unlock (&dir_lnode->lock);
+      }
+
+    /*If so, do not bother the underlying filesystem */
+    if (negative)
+      return ENOENT;
+
+    /*A name known to be a directory, from an earlier lookup or from a
+       snapshot, is opened as a directory at once, which saves the
+       lookup done only to find out what it is */
+    p = MACH_PORT_NULL;
+    if ((!lastcomp || !proxy) && lnode_is_dir (dir_lnode, name))
+      p = file_name_lookup_under
+	(dir_port, name, flags | O_READ | O_DIRECTORY, 0);
 
-    /*If this file is not a directory */
-    if (err || !S_ISDIR (stat.st_mode))
+    /*If it still is a directory */
+    if (p != MACH_PORT_NULL)
+      {
+	stat_valid = (io_stat (p, &stat) == 0);
+	isdir = 1;
+      }
+    else
       {
-	/*remember we do not have a directory */
-	isdir = 0;
+	/*Try to lookup the given file in the underlying directory */
+	p = file_name_lookup_under (dir_port, name, 0, 0);
 
-	if (!proxy)
+	/*If the lookup failed */
+	if (p == MACH_PORT_NULL)
 	  {
-	    /*We don't need to do lookups here if a proxy shadow node
-	      is required. The lookup will be done by the translator
-	      starting procedure. Just check whether the file
-	      exists.*/
+	    /*remember that there is no such entry, so that repeated
+	       lookups are answered without RPCs */
+	    if (errno == ENOENT)
+	      {
+		mutex_lock (&dir_lnode->lock);
+		lnode_negative_add (dir_lnode, name, dir_mtime);
+		mutex_unlock (&dir_lnode->lock);
+	      }
+
+	    /*no such entry */
+	    return ENOENT;
+	  }
+
+	/*Obtain the stat information about the file */
+	err = io_stat (p, &stat);
 
-	    p = file_name_lookup_under (dir->nn->port, name, flags, 0);
-	    if (p == MACH_PORT_NULL)
-	      return EBADF;
+	/*Remember whether `stat` can be trusted */
+	stat_valid = !err;
+
+	/*Deallocate the obtained port */
+	PORT_DEALLOC (p);
+
+	/*If this file is not a directory */
+	if (err || !S_ISDIR (stat.st_mode))
+	  {
+	    /*remember we do not have a directory */
+	    isdir = 0;
 
-	    /*If a proxy node is not required */
 	    if (!proxy)
-	      /*stop here, we want only the port to the file */
-	      return 0;
+	      {
+		/*We don't need to do lookups here if a proxy shadow node
+		  is required. The lookup will be done by the translator
+		  starting procedure. Just check whether the file
+		  exists.*/
+
+		p = file_name_lookup_under (dir_port, name, flags, 0);
+		if (p == MACH_PORT_NULL)
+		  return EBADF;
+
+		/*If a proxy node is not required */
+		if (!proxy)
+		  /*stop here, we want only the port to the file */
+		  return 0;
+	      }
+	    else
+		p = MACH_PORT_NULL;
 	  }
 	else
-	    p = MACH_PORT_NULL;
-      }
-    else
-      {
-	if (!lastcomp || !proxy)
 	  {
-	    p = file_name_lookup_under
-	      (dir->nn->port, name, flags | O_READ | O_DIRECTORY, 0);
-	    if (p == MACH_PORT_NULL)
-	      return EBADF;		/*not enough rights? */
+	    if (!lastcomp || !proxy)
+	      {
+		p = file_name_lookup_under
+		  (dir_port, name, flags | O_READ | O_DIRECTORY, 0);
+		if (p == MACH_PORT_NULL)
+		  return EBADF;		/*not enough rights? */
+	      }
+	    else
+	      /*If we are at the last component of the path and need to
+		open a directory, do not do the lookup; the translator
+		starting procedure will do that.*/
+	      p = MACH_PORT_NULL;
+
+	    /*we have a directory here */
+	    isdir = 1;
 	  }
-	else
-	  /*If we are at the last component of the path and need to
-	    open a directory, do not do the lookup; the translator
-	    starting procedure will do that.*/
-	  p = MACH_PORT_NULL;
-
-	/*we have a directory here */
-	isdir = 1;
       }
 
     /*Try to find an lnode called `name` under the lnode corresponding
-      to `dir` */
-    err = lnode_get (dir->nn->lnode, name, &lnode);
+      to `dir`; no locks are taken in `dir` if it is found */
+    err = lnode_get (dir_lnode, name, &lnode);
 
-    /*If such an entry does not exist */
+    /*If such an entry has not been found */
     if (err == ENOENT)
       {
-	/*create a new lnode with the supplied name */
-	err = lnode_create (name, &lnode);
-	if (err)
+	/*lock the lnode of `dir` to install the entry */
+	mutex_lock (&dir_lnode->lock);
+
+	/*someone may have installed the entry since the lookup above */
+	err = lnode_get (dir_lnode, name, &lnode);
+
+	/*If such an entry does not exist */
+	if (err == ENOENT)
 	  {
-	    finalize ();
-	    return err;
+	    /*create a new lnode with the supplied name */
+	    err = lnode_create (name, &lnode);
+	    if (err)
+	      {
+		mutex_unlock (&dir_lnode->lock);
+		return err;
+	      }
+
+	    /*install the new lnode into the directory */
+	    err = lnode_install (dir_lnode, lnode);
+	    if (err)
+	      {
+		mutex_unlock (&dir_lnode->lock);
+		lnode_destroy (lnode);
+		return err;
+	      }
 	  }
 
-	/*install the new lnode into the directory */
-	lnode_install (dir->nn->lnode, lnode);
+	mutex_unlock (&dir_lnode->lock);
       }
 
     /*If we are to create a proxy node */
@@ -677,38 +831,48 @@ error_t
       err = node_create_proxy (lnode, node);
     /*If we don't need proxy nodes in this lookup */
     else
-      {
-	/*obtain the node corresponding to this lnode */
-	err = ncache_node_lookup (lnode, node);
-
-	/*remove an extra reference from the lnode */
-	lnode_ref_remove (lnode);
-      }
+      /*obtain the node corresponding to this lnode */
+      err = ncache_node_lookup (lnode, node);
 
     /*If either the lookup in the cache or the creation of a proxy failed */
     if (err)
       {
-	/*stop */
+	/*unlock the lnode before removing our reference, which may be
+	   the last one */
 	mutex_unlock (&lnode->lock);
-	finalize ();
+	lnode_ref_remove (lnode);
+
+	/*stop */
 	return err;
       }
 
+    /*The node holds its own reference to the lnode, so remove the
+      extra reference obtained above */
+    lnode_ref_remove (lnode);
+
     /*Store the port in the node */
     (*node)->nn->port = p;
 
     /*Fill in the flag about the node being a directory */
-    if (isdir)
-      lnode->flags |= FLAG_LNODE_DIR;
-    else
-      lnode->flags &= ~FLAG_LNODE_DIR;
+    lnode_set_dir (lnode, isdir);
+
+    /*If the lnode has been restored from a snapshot, this is the first
+      time it is compared with the real file; if the file has been
+      replaced since the snapshot, forget what was known about it */
+    if (stat_valid)
+      {
+	if ((lnode->flags & FLAG_LNODE_SNAPSHOT)
+	    && (stat.st_gen != lnode->stat_gen))
+	  lnode_negative_flush (lnode);
+	lnode->flags &= ~FLAG_LNODE_SNAPSHOT;
+	lnode->stat_gen = stat.st_gen;
+      }
 
     /*Construct the full path to the node */
     err = lnode_path_construct (lnode, NULL);
     if (err)
       {
 	mutex_unlock (&lnode->lock);
-	finalize ();
 	return err;
       }
 
@@ -716,12 +880,34 @@ error_t
     mutex_unlock (&lnode->lock);
 
     /*Now the node is up-to-date */
-    (*node)->nn->flags = FLAG_NODE_ULFS_UPTODATE;
+    (*node)->nn->flags = FLAG_NODE_ULFS_UPTODATE
+      | ((*node)->nn->flags & FLAG_NODE_REFRESHING);
+
+    /*Let the port pool keep track of the port of the directory */
+    node_port_pool_add (*node);
 
     /*Everything OK here */
     return 0;
   }				/*lookup */
 
+  /*Hold our own right to the port of `dir`, since the port in the
+    node may be replaced once `dir` is unlocked */
+  if (dir_port != MACH_PORT_NULL)
+    {
+      err = mach_port_mod_refs
+	(mach_task_self (), dir_port, MACH_PORT_RIGHT_SEND, 1);
+      if (err)
+	{
+	  mutex_unlock (&dir->lock);
+	  return err;
+	}
+    }
+
+  /*Unlock `dir`: the node is kept alive by the reference of the
+    caller, and everything else required has been copied above, so
+    other lookups in `dir` need not wait for the RPCs below */
+  mutex_unlock (&dir->lock);
+
   /*Simply lookup the provided name, without creating the proxy, if not
     necessary (i.e. when the file is not a directory) */
   err = lookup (name, flags, proxy);
@@ -1583,7 +1769,8 @@ error_t
 }				/*netfs_attempt_write */
 
 /*---------------------------------------------------------------------------*/
-/*Frees all storage associated with the node*/
+/*Frees all storage associated with the node; called by libnetfs with
+  netfs_node_refcnt_lock held*/
 void netfs_node_norefs (struct node *np)
 {
   /*Destroy the node */
@@ -1723,6 +1910,16 @@ netfs_shutdown (int flags)
         return err;
     }
 
+  /*Save the lnode tree for the next start; a failure only makes the
+    next start slower */
+  if (snapshot_file)
+    {
+      err = snapshot_save (snapshot_file, netfs_root_node->nn->lnode, dir);
+      if (err)
+	LOG_MSG ("netfs_shutdown: Could not save the snapshot into %s.",
+		 snapshot_file);
+    }
+
   return 0;
 }				/*netfs_shutdown */
 
@@ -1766,6 +1963,21 @@ int main (int argc, char **argv)
   LOG_MSG ("Root node initialized.");
   LOG_MSG ("\tRoot node address: 0x%lX", (unsigned long) netfs_root_node);
 
+  /*Restore the lnode tree saved at the previous shutdown, if any; the
+    restored entries are validated as they are looked up */
+  if (snapshot_file)
+    {
+      err = snapshot_load (snapshot_file, netfs_root_node->nn->lnode, dir);
+      if (err)
+	{
+	  LOG_MSG ("Could not restore the snapshot from %s.", snapshot_file);
+	}
+      else
+	{
+	  LOG_MSG ("Snapshot restored.");
+	}
+    }
+
   /*Map the time for updating node information */
   err = maptime_map (0, 0, &maptime);
   if (err)
@@ -1773,9 +1985,21 @@ int main (int argc, char **argv)
   LOG_MSG ("Time mapped.");
 
   /*Initialize the cache with the required number of nodes */
-  ncache_init ( /*ncache_size */ );
+  ncache_init (ncache_size);
   LOG_MSG ("Cache initialized.");
 
+  /*Start refreshing stale stat information in the background */
+  node_stat_refresh_init ();
+  LOG_MSG ("stat refresher started.");
+
+  /*Start reclaiming the lnodes which are not referenced any more */
+  lnode_reclaim_init ();
+  LOG_MSG ("lnode reclaimer started.");
+
+  /*Start keeping the caches within their memory limit */
+  memory_governor_init ();
+  LOG_MSG ("Memory governor started.");
+
   /*Obtain stat information about the underlying node */
   err = io_stat (underlying_node, &underlying_node_stat);
   if (err)
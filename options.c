@@ -28,12 +28,19 @@
 #define _GNU_SOURCE 1
 /*---------------------------------------------------------------------------*/
 #include <argp.h>
+#include <errno.h>
+#include <limits.h>
+#include <argz.h>
 #include <error.h>
+#include <stdio.h>
 /*---------------------------------------------------------------------------*/
 #include "debug.h"
 #include "options.h"
 #include "ncache.h"
 #include "node.h"
+#include "stats.h"
+#include "snapshot.h"
+#include "memory.h"
 /*---------------------------------------------------------------------------*/
 
 /*---------------------------------------------------------------------------*/
@@ -57,6 +64,11 @@ static
   error_t
   argp_parse_startup_options (int key, char *arg, struct argp_state *state);
 /*---------------------------------------------------------------------------*/
+/*Argp parser function for the runtime options*/
+static
+  error_t
+  argp_parse_runtime_options (int key, char *arg, struct argp_state *state);
+/*---------------------------------------------------------------------------*/
 
 /*---------------------------------------------------------------------------*/
 /*--------Global Variables---------------------------------------------------*/
@@ -69,14 +81,61 @@ static int parsing_startup_options_finished;
 /*---------------------------------------------------------------------------*/
 /*Argp options common to both the runtime and the startup parser*/
 static const struct argp_option argp_common_options[] = {
-  /*{OPT_LONG_CACHE_SIZE, OPT_CACHE_SIZE, "SIZE", 0,
-     "The maximal number of nodes in the node cache"} */
+  {OPT_LONG_CACHE_SIZE, OPT_CACHE_SIZE, "SIZE", 0,
+   "The maximal number of nodes in the node cache"},
+  {OPT_LONG_MAX_PROXIES, OPT_MAX_PROXIES, "NUMBER", 0,
+   "The maximal number of proxy nodes of a single file; idle proxies are"
+   " reused once the limit is reached (0 means no limit)"},
+  {OPT_LONG_NEGATIVE_TTL, OPT_NEGATIVE_TTL, "MSECS", 0,
+   "The time for which a failed lookup is remembered (0 disables the"
+   " caching of failed lookups)"},
+  {OPT_LONG_MAX_NEGATIVES, OPT_MAX_NEGATIVES, "NUMBER", 0,
+   "The maximal number of failed lookups remembered in a single directory"},
+  {OPT_LONG_LNODE_MEMORY, OPT_LNODE_MEMORY, "BYTES", 0,
+   "The amount of memory the tree of looked up names may occupy before"
+   " the names which are not in use start being forgotten"},
+  {OPT_LONG_CACHE_POLICY, OPT_CACHE_POLICY, "POLICY", 0,
+   "The replacement policy of the node cache: lru, clock or 2q (2q keeps"
+   " the nodes used only once apart, so that scans do not flush the cache;"
+   " default: " NCACHE_POLICY ")"},
+  {OPT_LONG_STAT_TTL, OPT_STAT_TTL, "MSECS", 0,
+   "The time for which the attributes of a file are trusted without"
+   " asking the mirrored filesystem (0 disables the caching of"
+   " attributes)"},
+  {OPT_LONG_STAT_HARD_TTL, OPT_STAT_HARD_TTL, "MSECS", 0,
+   "The time for which stale attributes are still returned while they are"
+   " being refreshed in the background (not more than the value of"
+   " --" OPT_LONG_STAT_TTL " means that stale attributes are never returned)"},
+  {OPT_LONG_MAX_PORTS, OPT_MAX_PORTS, "NUMBER", 0,
+   "The maximal number of files keeping ports to the mirrored filesystem;"
+   " the least recently used ones give their ports up and reopen them when"
+   " needed (0 means that only directories keep ports, without a limit)"},
+  {OPT_LONG_MEMORY_LIMIT, OPT_MEMORY_LIMIT, "BYTES", 0,
+   "The amount of memory the caches may occupy before cached listings,"
+   " cached nodes and unused names start being released, in this order"
+   " (0 means no limit)"},
+  {OPT_LONG_PRESSURE_FILE, OPT_PRESSURE_FILE, "FILE", 0,
+   "Release all the memory the caches can spare whenever FILE is touched"},
   {0}
 };
 
 /*---------------------------------------------------------------------------*/
 /*Argp options only meaningful for startup parsing*/
 static const struct argp_option argp_startup_options[] = {
+  {OPT_LONG_SNAPSHOT, OPT_SNAPSHOT, "FILE", 0,
+   "Restore the tree of looked up names from FILE at startup and save it"
+   " there at shutdown"},
+  {0}
+};
+
+/*---------------------------------------------------------------------------*/
+/*Argp options only meaningful for runtime parsing*/
+static const struct argp_option argp_runtime_options[] = {
+  {OPT_LONG_DUMP_STATS, OPT_DUMP_STATS, "FILE", 0,
+   "Write the current values of the internal statistics counters to FILE"},
+  {OPT_LONG_RELEASE_MEMORY, OPT_RELEASE_MEMORY, "BYTES", OPTION_ARG_OPTIONAL,
+   "Release memory until the caches occupy at most BYTES (all the memory"
+   " the caches can spare by default)"},
   {0}
 };
 
@@ -89,8 +148,13 @@ static const struct argp argp_parser_common_options =
 static const struct argp argp_parser_startup_options =
   { argp_startup_options, argp_parse_startup_options, 0, 0, 0 };
 /*---------------------------------------------------------------------------*/
+/*Argp parser for only the runtime options*/
+static const struct argp argp_parser_runtime_options =
+  { argp_runtime_options, argp_parse_runtime_options, 0, 0, 0 };
+/*---------------------------------------------------------------------------*/
 /*The list of children parsers for runtime arguments*/
 static const struct argp_child argp_children_runtime[] = {
+  {&argp_parser_runtime_options},
   {&argp_parser_common_options},
   {&netfs_std_runtime_argp},
   {0}
@@ -123,6 +187,31 @@ char *dir = NULL;
 
 /*---------------------------------------------------------------------------*/
 /*--------Functions----------------------------------------------------------*/
+/*Parses `arg`, the value of the option `option`, as a decimal number
+  between 0 and `max` into `value`; a malformed value is reported
+  through `state` and nothing is stored*/
+static error_t
+  parse_number
+  (struct argp_state *state, const char *option, const char *arg,
+   long max, long *value)
+{
+  /*The end of the number and the number itself */
+  char *end;
+  long n;
+
+  errno = 0;
+  n = strtol (arg, &end, 10);
+  if ((end == arg) || *end || (errno == ERANGE) || (n < 0) || (n > max))
+    {
+      argp_error (state, "invalid value of --%s: %s", option, arg);
+      return EINVAL;
+    }
+
+  *value = n;
+  return 0;
+}				/*parse_number */
+
+/*---------------------------------------------------------------------------*/
 /*Argp parser function for the common options*/
 static
   error_t
@@ -130,18 +219,126 @@ static
 {
   error_t err = 0;
 
+  /*The value of a numeric option */
+  long value;
+
   /*Go through the possible options */
   switch (key)
     {
-      /*case OPT_CACHE_SIZE:
-         { */
-      /*store the new cache-size */
-      /*ncache_size = strtol(arg, NULL, 10);
+    case OPT_CACHE_SIZE:
+      {
+	/*store the new cache-size */
+	err = parse_number (state, OPT_LONG_CACHE_SIZE, arg, INT_MAX, &value);
+	if (!err)
+	  ncache_size = value;
+
+	break;
+      }
+    case OPT_MAX_PROXIES:
+      {
+	/*store the new limit of proxies per lnode */
+	err = parse_number (state, OPT_LONG_MAX_PROXIES, arg, INT_MAX, &value);
+	if (!err)
+	  lnode_proxies_max = value;
 
-         break;
-         } */
+	break;
+      }
+    case OPT_NEGATIVE_TTL:
+      {
+	/*store the new lifetime of negative entries */
+	err = parse_number (state, OPT_LONG_NEGATIVE_TTL, arg, INT_MAX, &value);
+	if (!err)
+	  lnode_negative_ttl = value;
+
+	break;
+      }
+    case OPT_MAX_NEGATIVES:
+      {
+	/*store the new limit of negative entries per directory */
+	err = parse_number (state, OPT_LONG_MAX_NEGATIVES, arg, INT_MAX, &value);
+	if (!err)
+	  lnode_negatives_max = value;
+
+	break;
+      }
+    case OPT_LNODE_MEMORY:
+      {
+	/*store the new memory budget of the lnode tree */
+	err = parse_number (state, OPT_LONG_LNODE_MEMORY, arg, LONG_MAX, &value);
+	if (!err)
+	  lnode_memory_max = value;
+
+	break;
+      }
+    case OPT_STAT_TTL:
+      {
+	/*store the new lifetime of the stat information */
+	err = parse_number (state, OPT_LONG_STAT_TTL, arg, INT_MAX, &value);
+	if (!err)
+	  node_stat_ttl = value;
+
+	break;
+      }
+    case OPT_STAT_HARD_TTL:
+      {
+	/*store the new lifetime of the stale stat information */
+	err = parse_number (state, OPT_LONG_STAT_HARD_TTL, arg, INT_MAX, &value);
+	if (!err)
+	  node_stat_hard_ttl = value;
+
+	break;
+      }
+    case OPT_MAX_PORTS:
+      {
+	/*store the new limit of the port pool */
+	err = parse_number (state, OPT_LONG_MAX_PORTS, arg, INT_MAX, &value);
+	if (!err)
+	  node_ports_max = value;
+
+	break;
+      }
+    case OPT_MEMORY_LIMIT:
+      {
+	/*store the new soft limit of the memory of the caches */
+	err = parse_number (state, OPT_LONG_MEMORY_LIMIT, arg, LONG_MAX, &value);
+	if (!err)
+	  memory_limit = value;
+
+	break;
+      }
+    case OPT_PRESSURE_FILE:
+      {
+	/*remember the file to watch, replacing the previous one */
+	err = memory_pressure_file_set (arg);
+
+	break;
+      }
+    case OPT_CACHE_POLICY:
+      {
+	/*choose the replacement policy of the node cache */
+	err = ncache_policy_set (arg);
+	if (err)
+	  argp_error (state, "unknown cache policy: %s", arg);
+
+	break;
+      }
     case ARGP_KEY_ARG:		/*the directory to mirror */
       {
+	/*The directory is chosen once and for all at startup; at
+	   runtime it only comes back with the options reported by
+	   netfs_append_args, so the same directory is ignored */
+	if (parsing_startup_options_finished)
+	  {
+	    if (strcmp (arg, dir) != 0)
+	      {
+		argp_error (state, "the mirrored directory cannot be "
+			    "changed at runtime: %s", arg);
+		err = EINVAL;
+	      }
+
+	    break;
+	  }
+
 	/*try to duplicate the directory name */
 	dir = strdup (arg);
 	if (!dir)
@@ -187,8 +384,19 @@ static
 	  }
 	else
 	  {
-/*TODO: Take care of runtime calls modifying the property*/
+	    /*apply the new limit of the node cache; the cache is
+	       shrunk in small batches, so lookups may proceed meanwhile */
+	    ncache_resize (ncache_size);
+
+	    /*give up the ports beyond the new limit */
+	    node_port_pool_trim ();
+
+	    /*bring the lnode tree within the new memory budget at once,
+	       instead of waiting for the reclaiming thread */
+	    lnode_reclaim ();
 	  }
+
+	break;
       }
       /*If the option could not be recognized */
     default:
@@ -213,6 +421,13 @@ static
 
   switch (key)
     {
+    case OPT_SNAPSHOT:
+      {
+	/*remember where the snapshot of the lnode tree is kept */
+	snapshot_file = arg;
+
+	break;
+      }
     default:
       {
 	err = ARGP_ERR_UNKNOWN;
@@ -225,3 +440,136 @@ static
 }				/*argp_parse_startup_options */
 
 /*---------------------------------------------------------------------------*/
+/*Argp parser function for the runtime options*/
+static
+  error_t
+  argp_parse_runtime_options (int key, char *arg, struct argp_state *state)
+{
+  error_t err = 0;
+
+  /*The target size of the caches */
+  long value;
+
+  switch (key)
+    {
+    case OPT_DUMP_STATS:
+      {
+	/*write the statistics report into the specified file */
+	err = stats_dump (arg);
+	if (err)
+	  LOG_MSG ("argp_parse_runtime_options: Could not dump the "
+		   "statistics into %s.", arg);
+
+	break;
+      }
+    case OPT_RELEASE_MEMORY:
+      {
+	/*shrink the caches at once, to the given size, if any */
+	value = 0;
+	if (arg)
+	  err = parse_number (state, OPT_LONG_RELEASE_MEMORY, arg, LONG_MAX,
+			      &value);
+	if (!err)
+	  memory_release (value);
+
+	break;
+      }
+    default:
+      {
+	err = ARGP_ERR_UNKNOWN;
+
+	break;
+      }
+    }
+
+  return err;
+}				/*argp_parse_runtime_options */
+
+/*---------------------------------------------------------------------------*/
+/*Appends `--option=value` to the argz vector `argz`*/
+static error_t
+  append_option (char **argz, size_t * argz_len, const char *option,
+		   long value)
+{
+  /*The option in the textual form */
+  char buf[64];
+
+  snprintf (buf, sizeof (buf), "--%s=%ld", option, value);
+  return argz_add (argz, argz_len, buf);
+}				/*append_option */
+
+/*---------------------------------------------------------------------------*/
+/*Appends the options currently in effect to `argz` (for fsysopts)*/
+error_t netfs_append_args (char **argz, size_t * argz_len)
+{
+  /*Append the options handled by libnetfs */
+  error_t err = netfs_append_std_options (argz, argz_len);
+
+  /*Append our own tuning knobs */
+  if (!err)
+    err = append_option (argz, argz_len, OPT_LONG_CACHE_SIZE, ncache_size);
+  if (!err)
+    err = append_option (argz, argz_len, OPT_LONG_MAX_PROXIES,
+			   lnode_proxies_max);
+  if (!err)
+    err = append_option (argz, argz_len, OPT_LONG_NEGATIVE_TTL,
+			   lnode_negative_ttl);
+  if (!err)
+    err = append_option (argz, argz_len, OPT_LONG_MAX_NEGATIVES,
+			   lnode_negatives_max);
+  if (!err)
+    err = append_option (argz, argz_len, OPT_LONG_LNODE_MEMORY,
+			   lnode_memory_max);
+  if (!err)
+    err = append_option (argz, argz_len, OPT_LONG_STAT_TTL, node_stat_ttl);
+  if (!err)
+    err = append_option (argz, argz_len, OPT_LONG_STAT_HARD_TTL,
+			 node_stat_hard_ttl);
+  if (!err)
+    err = append_option (argz, argz_len, OPT_LONG_MAX_PORTS, node_ports_max);
+  if (!err)
+    err = append_option (argz, argz_len, OPT_LONG_MEMORY_LIMIT,
+			 memory_limit);
+  if (!err)
+    {
+      /*The policy is given by its name */
+      char *policy;
+
+      if (asprintf (&policy, "--%s=%s", OPT_LONG_CACHE_POLICY,
+		    ncache_policy->name) < 0)
+	err = ENOMEM;
+      else
+	{
+	  err = argz_add (argz, argz_len, policy);
+	  free (policy);
+	}
+    }
+
+  if (!err)
+    {
+      /*The watched file is given by its path, which may be replaced
+         meanwhile, so a copy of it is used */
+      char *path = memory_pressure_file_get ();
+      char *file;
+
+      if (path)
+	{
+	  if (asprintf (&file, "--%s=%s", OPT_LONG_PRESSURE_FILE, path) < 0)
+	    err = ENOMEM;
+	  else
+	    {
+	      err = argz_add (argz, argz_len, file);
+	      free (file);
+	    }
+	  free (path);
+	}
+    }
+
+  /*Append the mirrored directory */
+  if (!err && dir)
+    err = argz_add (argz, argz_len, dir);
+
+  return err;
+}				/*netfs_append_args */
+
+/*---------------------------------------------------------------------------*/
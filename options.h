@@ -32,9 +32,35 @@
 
 /*The possible short options*/
 #define OPT_CACHE_SIZE 'c'
+#define OPT_DUMP_STATS 'D'
+#define OPT_MAX_PROXIES 'p'
+#define OPT_NEGATIVE_TTL 'n'
+#define OPT_MAX_NEGATIVES 'N'
+#define OPT_LNODE_MEMORY 'm'
+#define OPT_SNAPSHOT 's'
+#define OPT_CACHE_POLICY 'P'
+#define OPT_STAT_TTL 't'
+#define OPT_STAT_HARD_TTL 'T'
+#define OPT_MAX_PORTS 'o'
+#define OPT_MEMORY_LIMIT 'L'
+#define OPT_PRESSURE_FILE 'F'
+#define OPT_RELEASE_MEMORY 'R'
 /*---------------------------------------------------------------------------*/
 /*The corresponding long options*/
 #define OPT_LONG_CACHE_SIZE "cache-size"
+#define OPT_LONG_DUMP_STATS "dump-stats"
+#define OPT_LONG_MAX_PROXIES "max-proxies"
+#define OPT_LONG_NEGATIVE_TTL "negative-ttl"
+#define OPT_LONG_MAX_NEGATIVES "max-negatives"
+#define OPT_LONG_LNODE_MEMORY "lnode-memory"
+#define OPT_LONG_SNAPSHOT "snapshot"
+#define OPT_LONG_CACHE_POLICY "cache-policy"
+#define OPT_LONG_STAT_TTL "stat-ttl"
+#define OPT_LONG_STAT_HARD_TTL "stat-hard-ttl"
+#define OPT_LONG_MAX_PORTS "max-ports"
+#define OPT_LONG_MEMORY_LIMIT "memory-limit"
+#define OPT_LONG_PRESSURE_FILE "pressure-file"
+#define OPT_LONG_RELEASE_MEMORY "release-memory"
 /*---------------------------------------------------------------------------*/
 /*Makes a long option out of option name*/
 #define OPT_LONG(o) "--"o
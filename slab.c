@@ -0,0 +1,220 @@
+/*---------------------------------------------------------------------------*/
+/*slab.c*/
+/*---------------------------------------------------------------------------*/
+/*The allocator of fixed-size objects.*/
+/*---------------------------------------------------------------------------*/
+/*Copyright (C) 2009 Free Software Foundation, Inc.
+
+  This program is free software; you can redistribute it and/or
+  modify it under the terms of the GNU General Public License as
+  published by the Free Software Foundation; either version 2 of the
+  License, or * (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+  General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307
+  USA.*/
+/*---------------------------------------------------------------------------*/
+
+/*---------------------------------------------------------------------------*/
+#define _GNU_SOURCE 1
+/*---------------------------------------------------------------------------*/
+#include <stdlib.h>
+/*---------------------------------------------------------------------------*/
+#include "slab.h"
+/*---------------------------------------------------------------------------*/
+
+/*---------------------------------------------------------------------------*/
+/*--------Macros-------------------------------------------------------------*/
+/*The link to the next free object, stored in the first word of `obj`*/
+#define SLAB_NEXT(obj) (*(void **) (obj))
+/*---------------------------------------------------------------------------*/
+
+/*---------------------------------------------------------------------------*/
+/*--------Functions----------------------------------------------------------*/
+/*Returns the free list of `slab` which the current thread should use*/
+static struct slab_freelist *slab_freelist (slab_t * slab)
+{
+  /*The ID of the current thread; the low bits are dropped, since
+     cthread structures are aligned */
+  unsigned long id = (unsigned long) cthread_self () >> 4;
+
+  return &slab->freelists[id % SLAB_FREELISTS];
+}				/*slab_freelist */
+
+/*---------------------------------------------------------------------------*/
+/*Obtains a list of free objects for `slab` from the depot or from a
+  new chunk of memory; stores the first and the last objects of the
+  list in `head` and `tail` and returns the number of objects in the
+  list (0 if no memory is available)*/
+static int slab_refill (slab_t * slab, void **head, void **tail)
+{
+  /*A pointer to an object */
+  void *obj;
+
+  /*The new chunk of memory */
+  char *chunk;
+
+  int i;
+
+  *head = *tail = NULL;
+
+  mutex_lock (&slab->lock);
+
+  /*If there are free objects in the depot, take half a list of them */
+  if (slab->depot)
+    {
+      *head = *tail = slab->depot;
+      for (i = 1; SLAB_NEXT (*tail) && (i < SLAB_FREELIST_MAX / 2); ++i)
+	*tail = SLAB_NEXT (*tail);
+
+      slab->depot = SLAB_NEXT (*tail);
+      slab->depot_count -= i;
+
+      mutex_unlock (&slab->lock);
+      return i;
+    }
+
+  mutex_unlock (&slab->lock);
+
+  /*Carve out a new chunk; chunks are never given back to the system */
+  chunk = malloc (slab->size * SLAB_CHUNK_OBJECTS);
+  if (!chunk)
+    return 0;
+
+  /*Link all objects of the chunk into a list */
+  for (i = SLAB_CHUNK_OBJECTS - 1; i >= 0; --i)
+    {
+      obj = chunk + i * slab->size;
+
+      SLAB_NEXT (obj) = *head;
+      *head = obj;
+    }
+  *tail = chunk + (SLAB_CHUNK_OBJECTS - 1) * slab->size;
+
+  /*Count the new objects */
+  __sync_fetch_and_add (&slab->allocated, SLAB_CHUNK_OBJECTS);
+
+  return SLAB_CHUNK_OBJECTS;
+}				/*slab_refill */
+
+/*---------------------------------------------------------------------------*/
+/*Allocates an object from `slab`; returns NULL if no memory is
+  available. The contents of the object are undefined*/
+void *slab_alloc (slab_t * slab)
+{
+  /*The free list of the current thread */
+  struct slab_freelist *fl = slab_freelist (slab);
+
+  /*The allocated object */
+  void *obj;
+
+  /*The list of objects obtained by a refill */
+  void *head, *tail;
+  int count;
+
+  spin_lock (&fl->lock);
+
+  /*Take the first object from the free list, if there is one */
+  obj = fl->head;
+  if (obj)
+    {
+      fl->head = SLAB_NEXT (obj);
+      --fl->count;
+    }
+
+  spin_unlock (&fl->lock);
+
+  /*If the free list was empty, fetch some new objects (without
+     holding the spin lock, since this may block) */
+  if (!obj)
+    {
+      count = slab_refill (slab, &head, &tail);
+      if (!count)
+	return NULL;
+
+      /*keep the first object and give the others to the free list */
+      obj = head;
+
+      if (count > 1)
+	{
+	  spin_lock (&fl->lock);
+
+	  SLAB_NEXT (tail) = fl->head;
+	  fl->head = SLAB_NEXT (obj);
+	  fl->count += count - 1;
+
+	  spin_unlock (&fl->lock);
+	}
+    }
+
+  /*Count the new object in use */
+  __sync_fetch_and_add (&slab->live, 1);
+
+  return obj;
+}				/*slab_alloc */
+
+/*---------------------------------------------------------------------------*/
+/*Returns `obj`, previously obtained from `slab`, to `slab`*/
+void slab_free (slab_t * slab, void *obj)
+{
+  /*The free list of the current thread */
+  struct slab_freelist *fl = slab_freelist (slab);
+
+  /*The objects moved to the depot */
+  void *surplus = NULL, *last = NULL;
+
+  int i;
+
+  spin_lock (&fl->lock);
+
+  /*Put the object at the beginning of the free list */
+  SLAB_NEXT (obj) = fl->head;
+  fl->head = obj;
+  ++fl->count;
+
+  /*If the free list has grown too long, detach half of it */
+  if (fl->count > SLAB_FREELIST_MAX)
+    {
+      surplus = last = fl->head;
+      for (i = 1; i < SLAB_FREELIST_MAX / 2; ++i)
+	last = SLAB_NEXT (last);
+
+      fl->head = SLAB_NEXT (last);
+      fl->count -= SLAB_FREELIST_MAX / 2;
+    }
+
+  spin_unlock (&fl->lock);
+
+  /*If there are surplus objects, move them to the depot */
+  if (surplus)
+    {
+      mutex_lock (&slab->lock);
+
+      SLAB_NEXT (last) = slab->depot;
+      slab->depot = surplus;
+      slab->depot_count += SLAB_FREELIST_MAX / 2;
+
+      mutex_unlock (&slab->lock);
+    }
+
+  /*Count the release of the object */
+  __sync_fetch_and_sub (&slab->live, 1);
+}				/*slab_free */
+
+/*---------------------------------------------------------------------------*/
+/*Prints the counters of `slab` to `f`*/
+void slab_report (slab_t * slab, FILE * f)
+{
+  fprintf (f, "slab %s: object size %lu, allocated %lu, live %lu, "
+	   "bytes %lu\n", slab->name, (unsigned long) slab->size,
+	   slab->allocated, slab->live,
+	   (unsigned long) (slab->allocated * slab->size));
+}				/*slab_report */
+
+/*---------------------------------------------------------------------------*/
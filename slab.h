@@ -0,0 +1,118 @@
+/*---------------------------------------------------------------------------*/
+/*slab.h*/
+/*---------------------------------------------------------------------------*/
+/*Declarations of the allocator of fixed-size objects.*/
+/*---------------------------------------------------------------------------*/
+/*Copyright (C) 2009 Free Software Foundation, Inc.
+
+  This program is free software; you can redistribute it and/or
+  modify it under the terms of the GNU General Public License as
+  published by the Free Software Foundation; either version 2 of the
+  License, or * (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+  General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307
+  USA.*/
+/*---------------------------------------------------------------------------*/
+#ifndef __SLAB_H__
+#define __SLAB_H__
+
+/*---------------------------------------------------------------------------*/
+#include <stdio.h>
+#include <error.h>
+#include <cthreads.h>
+/*---------------------------------------------------------------------------*/
+
+/*---------------------------------------------------------------------------*/
+/*--------Macros-------------------------------------------------------------*/
+/*The number of free lists in a slab. Each thread works with the free
+  list selected by its ID, so that threads do not contend for the
+  same list most of the time*/
+#define SLAB_FREELISTS 8
+/*---------------------------------------------------------------------------*/
+/*The maximal number of objects kept in a single free list; the
+  surplus is moved to the common depot of the slab*/
+#define SLAB_FREELIST_MAX 64
+/*---------------------------------------------------------------------------*/
+/*The number of objects carved out of a single chunk of memory*/
+#define SLAB_CHUNK_OBJECTS 64
+/*---------------------------------------------------------------------------*/
+/*Rounds the size of an object so that it can hold a pointer (free
+  objects are linked through their first word) and is suitably
+  aligned*/
+#define SLAB_OBJECT_SIZE(size)\
+	(((size) + sizeof (void *) - 1) & ~(sizeof (void *) - 1))
+/*---------------------------------------------------------------------------*/
+/*Statically initializes a slab for objects of type `type`. The
+  spin locks of the free lists are left zeroed, which is what
+  SPIN_LOCK_INITIALIZER expands to*/
+#define SLAB_INITIALIZER(name, type)\
+	{(name), SLAB_OBJECT_SIZE (sizeof (type)), MUTEX_INITIALIZER}
+/*---------------------------------------------------------------------------*/
+
+/*---------------------------------------------------------------------------*/
+/*--------Types--------------------------------------------------------------*/
+/*A list of free objects*/
+struct slab_freelist
+{
+  /*the lock protecting this list */
+  spin_lock_t lock;
+
+  /*the first free object; the objects are linked through their first
+     word */
+  void *head;
+
+  /*the number of objects in the list */
+  int count;
+};				/*struct slab_freelist */
+/*---------------------------------------------------------------------------*/
+/*An allocator of objects of the same size*/
+struct slab
+{
+  /*the name of the objects (for reports) */
+  const char *name;
+
+  /*the size of a single object */
+  size_t size;
+
+  /*the lock protecting `depot` and the carving of new chunks */
+  struct mutex lock;
+
+  /*the free objects which did not fit into the free lists */
+  void *depot;
+
+  /*the number of objects in `depot` */
+  int depot_count;
+
+  /*the free lists used by the threads */
+  struct slab_freelist freelists[SLAB_FREELISTS];
+
+  /*the number of objects ever carved out of chunks */
+  unsigned long allocated;
+
+  /*the number of objects currently handed out */
+  unsigned long live;
+};				/*struct slab */
+/*---------------------------------------------------------------------------*/
+typedef struct slab slab_t;
+/*---------------------------------------------------------------------------*/
+
+/*---------------------------------------------------------------------------*/
+/*--------Functions----------------------------------------------------------*/
+/*Allocates an object from `slab`; returns NULL if no memory is
+  available. The contents of the object are undefined*/
+void *slab_alloc (slab_t * slab);
+/*---------------------------------------------------------------------------*/
+/*Returns `obj`, previously obtained from `slab`, to `slab`*/
+void slab_free (slab_t * slab, void *obj);
+/*---------------------------------------------------------------------------*/
+/*Prints the counters of `slab` to `f`*/
+void slab_report (slab_t * slab, FILE * f);
+/*---------------------------------------------------------------------------*/
+#endif /*__SLAB_H__*/
@@ -0,0 +1,437 @@
+/*---------------------------------------------------------------------------*/
+/*snapshot.c*/
+/*---------------------------------------------------------------------------*/
+/*Saving the lnode tree across restarts.*/
+/*---------------------------------------------------------------------------*/
+/*Copyright (C) 2009 Free Software Foundation, Inc.
+
+  This program is free software; you can redistribute it and/or
+  modify it under the terms of the GNU General Public License as
+  published by the Free Software Foundation; either version 2 of the
+  License, or * (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+  General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307
+  USA.*/
+/*---------------------------------------------------------------------------*/
+
+/*---------------------------------------------------------------------------*/
+#define _GNU_SOURCE 1
+/*---------------------------------------------------------------------------*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+/*---------------------------------------------------------------------------*/
+#include "snapshot.h"
+#include "debug.h"
+/*---------------------------------------------------------------------------*/
+
+/*---------------------------------------------------------------------------*/
+/*--------Types--------------------------------------------------------------*/
+/*The snapshot being built in memory*/
+struct snapshot_buffer
+{
+  /*the records and the number of records allocated and used */
+  snapshot_record_t *records;
+  size_t records_size, count;
+
+  /*the names and the number of bytes allocated and used */
+  char *names;
+  size_t names_alloc, names_size;
+};				/*struct snapshot_buffer */
+/*---------------------------------------------------------------------------*/
+typedef struct snapshot_buffer snapshot_buffer_t;
+/*---------------------------------------------------------------------------*/
+
+/*---------------------------------------------------------------------------*/
+/*--------Global Variables---------------------------------------------------*/
+/*The file the lnode tree is saved to at shutdown and restored from at
+  startup (NULL if none)*/
+char *snapshot_file;
+/*---------------------------------------------------------------------------*/
+
+/*---------------------------------------------------------------------------*/
+/*--------Functions----------------------------------------------------------*/
+/*Appends the record of `node`, whose parent has the record `parent`,
+  to `buf`*/
+static error_t snapshot_append
+  (snapshot_buffer_t * buf, lnode_t * node, uint32_t parent)
+{
+  /*The record being added */
+  snapshot_record_t *rec;
+
+  /*Make room for the record */
+  if (buf->count == buf->records_size)
+    {
+      size_t size = buf->records_size ? buf->records_size * 2 : 256;
+      rec = realloc (buf->records, size * sizeof (snapshot_record_t));
+      if (!rec)
+	return ENOMEM;
+      buf->records = rec;
+      buf->records_size = size;
+    }
+
+  /*Make room for the name and its terminal 0 */
+  if (buf->names_size + node->iname->len + 1 > buf->names_alloc)
+    {
+      size_t size = buf->names_alloc ? buf->names_alloc * 2 : 4096;
+      char *names;
+
+      while (buf->names_size + node->iname->len + 1 > size)
+	size *= 2;
+
+      names = realloc (buf->names, size);
+      if (!names)
+	return ENOMEM;
+      buf->names = names;
+      buf->names_alloc = size;
+    }
+
+  /*Fill in the record */
+  rec = &buf->records[buf->count++];
+  rec->parent = parent;
+  rec->flags = node->flags & FLAG_LNODE_DIR;
+  rec->gen = node->stat_gen;
+  rec->name_offs = buf->names_size;
+  rec->name_len = node->iname->len;
+
+  /*Store the name */
+  memcpy (buf->names + buf->names_size, node->name, node->iname->len + 1);
+  buf->names_size += node->iname->len + 1;
+
+  return 0;
+}				/*snapshot_append */
+
+/*---------------------------------------------------------------------------*/
+/*Appends the records of the entries of `dir`, whose record is
+  `index`, and of their descendants to `buf`. The lnodes are locked
+  from the parent to the children, which is the usual order*/
+static error_t snapshot_collect
+  (snapshot_buffer_t * buf, lnode_t * dir, uint32_t index)
+{
+  error_t err = 0;
+
+  /*The entry being saved */
+  lnode_t *n;
+
+  /*Entries are only removed with the directory locked */
+  mutex_lock (&dir->lock);
+
+  for (n = dir->entries; n && !err; n = n->next)
+    {
+      /*the index of the record of `n` */
+      uint32_t n_index = buf->count;
+
+      err = snapshot_append (buf, n, index);
+
+      /*If `n` has entries of its own, save them, too */
+      if (!err && n->entries)
+	err = snapshot_collect (buf, n, n_index);
+    }
+
+  mutex_unlock (&dir->lock);
+
+  return err;
+}				/*snapshot_collect */
+
+/*---------------------------------------------------------------------------*/
+/*Writes the lnode tree below `root`, which mirrors the directory
+  `root_path`, into the file `path`*/
+error_t snapshot_save
+  (const char * path, lnode_t * root, const char * root_path)
+{
+  error_t err;
+
+  /*The snapshot built in memory */
+  snapshot_buffer_t buf;
+
+  /*The header of the file */
+  snapshot_header_t hdr;
+
+  /*The zeros used to pad the parts of the file */
+  static const char pad[4];
+
+  /*The file being written, which replaces `path` only once it is
+     complete, so that a failed save leaves the previous snapshot */
+  FILE *f;
+  char *tmp = NULL;
+  int fd;
+
+  memset (&buf, 0, sizeof (buf));
+
+  /*Collect the records of all lnodes */
+  err = snapshot_collect (&buf, root, SNAPSHOT_ROOT);
+  if (err)
+    goto out;
+
+  /*Setup the header */
+  memcpy (hdr.magic, SNAPSHOT_MAGIC, sizeof (hdr.magic));
+  hdr.version = SNAPSHOT_VERSION;
+  hdr.count = buf.count;
+  hdr.names_size = buf.names_size;
+  hdr.root_len = strlen (root_path);
+
+  /*Create the temporary file next to `path`, so that it can be
+     renamed over it */
+  if (asprintf (&tmp, "%s.XXXXXX", path) < 0)
+    {
+      tmp = NULL;
+      err = ENOMEM;
+      goto out;
+    }
+  fd = mkstemp (tmp);
+  if (fd < 0)
+    {
+      err = errno;
+      free (tmp);
+      tmp = NULL;
+      goto out;
+    }
+  f = fdopen (fd, "w");
+  if (!f)
+    {
+      err = errno;
+      close (fd);
+      goto out;
+    }
+
+  /*Write the parts of the file one after another and make sure they
+     have reached the disk before the file replaces the old one */
+  if ((fwrite (&hdr, sizeof (hdr), 1, f) != 1)
+      || (fwrite (root_path, 1, hdr.root_len, f) != hdr.root_len)
+      || (fwrite (pad, 1, SNAPSHOT_ALIGN (hdr.root_len) - hdr.root_len, f)
+	  != SNAPSHOT_ALIGN (hdr.root_len) - hdr.root_len)
+      || (fwrite (buf.records, sizeof (snapshot_record_t), buf.count, f)
+	  != buf.count)
+      || (fwrite (buf.names, 1, buf.names_size, f) != buf.names_size)
+      || (fflush (f) != 0) || (fsync (fileno (f)) != 0))
+    err = errno ? errno : EIO;
+
+  if ((fclose (f) != 0) && !err)
+    err = errno;
+
+  if (!err && (rename (tmp, path) != 0))
+    err = errno;
+
+  if (!err)
+    LOG_MSG ("snapshot_save: Saved %lu lnodes into %s.",
+	     (unsigned long) buf.count, path);
+
+out:
+  /*Do not leave a partial snapshot behind */
+  if (tmp)
+    {
+      if (err)
+	unlink (tmp);
+      free (tmp);
+    }
+
+  free (buf.records);
+  free (buf.names);
+
+  return err;
+}				/*snapshot_save */
+
+/*---------------------------------------------------------------------------*/
+/*Restores the lnode tree below `root`, which mirrors the directory
+  `root_path`, from the file `path`. The shallowest entries are restored
+  first, and no more than the memory budget of the tree allows. The
+  restored lnodes are marked with FLAG_LNODE_SNAPSHOT and are checked
+  against the underlying filesystem when they are looked up for the
+  first time*/
+error_t snapshot_load
+  (const char * path, lnode_t * root, const char * root_path)
+{
+  error_t err = 0;
+
+  /*The file and its size */
+  int fd;
+  struct stat st;
+
+  /*The contents of the file */
+  char *data;
+  const snapshot_header_t *hdr;
+  const snapshot_record_t *records;
+  const char *names;
+
+  /*The lnodes restored, indexed like the records */
+  lnode_t **made;
+
+  /*The depth of every record (SNAPSHOT_ROOT if the record is broken),
+     the number of records of every depth and the order of restoring */
+  uint32_t *depth, *count, *order;
+
+  /*The index of the current record, the current position in `order`,
+     the number of records in it and the number of lnodes restored */
+  uint32_t i, k, ordered, restored = 0;
+
+  /*The lnode being restored and its parent */
+  lnode_t *node, *dir;
+
+  fd = open (path, O_RDONLY);
+  if (fd < 0)
+    return errno;
+
+  if (fstat (fd, &st) < 0)
+    {
+      err = errno;
+      close (fd);
+      return err;
+    }
+
+  /*The file is only read, so map it instead of copying it */
+  data = (st.st_size >= sizeof (snapshot_header_t))
+    ? mmap (0, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0) : MAP_FAILED;
+  close (fd);
+  if (data == MAP_FAILED)
+    return (st.st_size >= sizeof (snapshot_header_t)) ? errno : EINVAL;
+
+  /*Check that the file is a snapshot of the directory being mirrored
+     and that all its parts are within the file */
+  hdr = (const snapshot_header_t *) data;
+  if ((memcmp (hdr->magic, SNAPSHOT_MAGIC, sizeof (hdr->magic)) != 0)
+      || (hdr->version != SNAPSHOT_VERSION)
+      || (hdr->root_len != strlen (root_path))
+      || (sizeof (snapshot_header_t) + (size_t) SNAPSHOT_ALIGN (hdr->root_len)
+	  + (size_t) hdr->count * sizeof (snapshot_record_t)
+	  + hdr->names_size > st.st_size)
+      || (memcmp (data + sizeof (snapshot_header_t), root_path,
+		  hdr->root_len) != 0))
+    {
+      munmap (data, st.st_size);
+      return EINVAL;
+    }
+
+  records = (const snapshot_record_t *)
+    (data + sizeof (snapshot_header_t) + SNAPSHOT_ALIGN (hdr->root_len));
+  names = (const char *) (records + hdr->count);
+
+  made = calloc (hdr->count, sizeof (lnode_t *));
+  depth = malloc (hdr->count * sizeof (uint32_t));
+  count = calloc (hdr->count + 1, sizeof (uint32_t));
+  order = malloc (hdr->count * sizeof (uint32_t));
+  if (!made || !depth || !count || !order)
+    {
+      free (made);
+      free (depth);
+      free (count);
+      free (order);
+      munmap (data, st.st_size);
+      return ENOMEM;
+    }
+
+  /*Sort the records by depth (the parent of a record always comes
+     before it), so that the shallowest entries, which every lookup
+     below them goes through, are restored first */
+  for (i = 0; i < hdr->count; ++i)
+    {
+      if (records[i].parent == SNAPSHOT_ROOT)
+	depth[i] = 0;
+      else if ((records[i].parent < i)
+	       && (depth[records[i].parent] != SNAPSHOT_ROOT))
+	depth[i] = depth[records[i].parent] + 1;
+      else
+	depth[i] = SNAPSHOT_ROOT;
+
+      if (depth[i] != SNAPSHOT_ROOT)
+	++count[depth[i] + 1];
+    }
+  for (i = 1; i <= hdr->count; ++i)
+    count[i] += count[i - 1];
+  for (i = 0, ordered = 0; i < hdr->count; ++i)
+    if (depth[i] != SNAPSHOT_ROOT)
+      {
+	order[count[depth[i]]++] = i;
+	++ordered;
+      }
+
+  /*Restore the lnodes until the tree reaches its memory budget, which
+     would only make the reclaimer prune the rest at once; a record
+     which cannot be restored is skipped together with its
+     descendants */
+  for (k = 0; k < ordered; ++k)
+    {
+      if (lnode_memory_used () >= lnode_memory_max)
+	break;
+
+      i = order[k];
+
+      /*find the parent, which has been restored before the entry */
+      if (records[i].parent == SNAPSHOT_ROOT)
+	dir = root;
+      else
+	dir = made[records[i].parent];
+
+      /*skip the records with a missing parent or a broken name */
+      if (!dir
+	  || ((size_t) records[i].name_offs + records[i].name_len
+	      >= hdr->names_size)
+	  || names[records[i].name_offs + records[i].name_len])
+	continue;
+
+      mutex_lock (&dir->lock);
+
+      /*If the entry already exists, reuse it */
+      err = lnode_get (dir, (char *) names + records[i].name_offs, &node);
+      if (err)
+	{
+	  /*create the entry and install it */
+	  err = lnode_create ((char *) names + records[i].name_offs, &node);
+	  if (!err)
+	    {
+	      err = lnode_install (dir, node);
+	      if (err)
+		lnode_destroy (node);
+	    }
+	}
+
+      mutex_unlock (&dir->lock);
+
+      /*If the entry could not be restored, go on with the others */
+      if (err)
+	{
+	  err = 0;
+	  continue;
+	}
+
+      /*Restore what is known about the entry and mark it for
+         validation */
+      lnode_set_dir (node, records[i].flags & FLAG_LNODE_DIR);
+      node->stat_gen = records[i].gen;
+      node->flags |= FLAG_LNODE_SNAPSHOT;
+      mutex_unlock (&node->lock);
+
+      made[i] = node;
+      ++restored;
+    }
+
+  /*Drop the references obtained above; the entries without entries
+     of their own become idle and are kept as long as the memory budget
+     of the tree allows */
+  for (i = 0; i < hdr->count; ++i)
+    if (made[i])
+      lnode_ref_remove (made[i]);
+
+  LOG_MSG ("snapshot_load: Restored %lu of %lu lnodes from %s.",
+	   (unsigned long) restored, (unsigned long) hdr->count, path);
+
+  free (made);
+  free (depth);
+  free (count);
+  free (order);
+  munmap (data, st.st_size);
+
+  return 0;
+}				/*snapshot_load */
+
+/*---------------------------------------------------------------------------*/
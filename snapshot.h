@@ -0,0 +1,118 @@
+/*---------------------------------------------------------------------------*/
+/*snapshot.h*/
+/*---------------------------------------------------------------------------*/
+/*Saving the lnode tree across restarts.*/
+/*---------------------------------------------------------------------------*/
+/*Copyright (C) 2009 Free Software Foundation, Inc.
+
+  This program is free software; you can redistribute it and/or
+  modify it under the terms of the GNU General Public License as
+  published by the Free Software Foundation; either version 2 of the
+  License, or * (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+  General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307
+  USA.*/
+/*---------------------------------------------------------------------------*/
+#ifndef __SNAPSHOT_H__
+#define __SNAPSHOT_H__
+
+/*---------------------------------------------------------------------------*/
+#include <stdint.h>
+#include <error.h>
+/*---------------------------------------------------------------------------*/
+#include "lnode.h"
+/*---------------------------------------------------------------------------*/
+
+/*---------------------------------------------------------------------------*/
+/*--------Macros-------------------------------------------------------------*/
+/*The signature at the beginning of a snapshot file*/
+#define SNAPSHOT_MAGIC "nsmuxsnp"
+/*---------------------------------------------------------------------------*/
+/*The version of the format of snapshot files*/
+#define SNAPSHOT_VERSION 1
+/*---------------------------------------------------------------------------*/
+/*The index of the parent of the entries of the root lnode*/
+#define SNAPSHOT_ROOT ((uint32_t) -1)
+/*---------------------------------------------------------------------------*/
+/*The alignment of the parts of a snapshot file*/
+#define SNAPSHOT_ALIGN(size) (((size) + 3) & ~3)
+/*---------------------------------------------------------------------------*/
+
+/*---------------------------------------------------------------------------*/
+/*--------Types--------------------------------------------------------------*/
+/*The header of a snapshot file. It is followed by the path to the
+  mirrored directory, the records of the lnodes and the names of the
+  lnodes (each terminated with a 0), every part aligned with
+  SNAPSHOT_ALIGN*/
+struct snapshot_header
+{
+  /*SNAPSHOT_MAGIC, without the terminal 0 */
+  char magic[8];
+
+  /*SNAPSHOT_VERSION */
+  uint32_t version;
+
+  /*the number of records */
+  uint32_t count;
+
+  /*the size of the names */
+  uint32_t names_size;
+
+  /*the length of the path to the mirrored directory */
+  uint32_t root_len;
+};				/*struct snapshot_header */
+/*---------------------------------------------------------------------------*/
+typedef struct snapshot_header snapshot_header_t;
+/*---------------------------------------------------------------------------*/
+/*The record of a single lnode; the parent of an lnode always comes
+  before the lnode itself*/
+struct snapshot_record
+{
+  /*the index of the record of the parent, or SNAPSHOT_ROOT */
+  uint32_t parent;
+
+  /*the flags of the lnode (FLAG_LNODE_DIR only) */
+  uint32_t flags;
+
+  /*the generation of the file, as reported by io_stat */
+  uint32_t gen;
+
+  /*the offset of the name in the names and its length */
+  uint32_t name_offs;
+  uint32_t name_len;
+};				/*struct snapshot_record */
+/*---------------------------------------------------------------------------*/
+typedef struct snapshot_record snapshot_record_t;
+/*---------------------------------------------------------------------------*/
+
+/*---------------------------------------------------------------------------*/
+/*--------Global Variables---------------------------------------------------*/
+/*The file the lnode tree is saved to at shutdown and restored from at
+  startup (NULL if none)*/
+extern char *snapshot_file;
+/*---------------------------------------------------------------------------*/
+
+/*---------------------------------------------------------------------------*/
+/*--------Functions----------------------------------------------------------*/
+/*Writes the lnode tree below `root`, which mirrors the directory
+  `root_path`, into the file `path`*/
+error_t snapshot_save
+  (const char * path, lnode_t * root, const char * root_path);
+/*---------------------------------------------------------------------------*/
+/*Restores the lnode tree below `root`, which mirrors the directory
+  `root_path`, from the file `path`. The shallowest entries are restored
+  first, and no more than the memory budget of the tree allows. The
+  restored lnodes are marked with FLAG_LNODE_SNAPSHOT and are checked
+  against the underlying filesystem when they are looked up for the
+  first time*/
+error_t snapshot_load
+  (const char * path, lnode_t * root, const char * root_path);
+/*---------------------------------------------------------------------------*/
+#endif /*__SNAPSHOT_H__*/
@@ -0,0 +1,95 @@
+/*---------------------------------------------------------------------------*/
+/*stats.c*/
+/*---------------------------------------------------------------------------*/
+/*Reporting of the internal statistics.*/
+/*---------------------------------------------------------------------------*/
+/*Copyright (C) 2009 Free Software Foundation, Inc.
+
+  This program is free software; you can redistribute it and/or
+  modify it under the terms of the GNU General Public License as
+  published by the Free Software Foundation; either version 2 of the
+  License, or * (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+  General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307
+  USA.*/
+/*---------------------------------------------------------------------------*/
+
+/*---------------------------------------------------------------------------*/
+#define _GNU_SOURCE 1
+/*---------------------------------------------------------------------------*/
+#include <errno.h>
+/*---------------------------------------------------------------------------*/
+#include "stats.h"
+#include "slab.h"
+#include "lnode.h"
+#include "intern.h"
+#include "node.h"
+#include "ncache.h"
+#include "memory.h"
+/*---------------------------------------------------------------------------*/
+
+/*---------------------------------------------------------------------------*/
+/*--------Functions----------------------------------------------------------*/
+/*Prints the current values of all statistics counters to `f`*/
+void stats_report (FILE * f)
+{
+  /*Report the state of the allocators */
+  slab_report (&lnode_slab, f);
+  slab_report (&netnode_slab, f);
+
+  /*Report the size of the lnode tree */
+  lnode_report (f);
+
+  /*Report the efficiency of the node cache */
+  ncache_report (f);
+
+  /*Report the sharing of names */
+  intern_report (f);
+
+  /*Report the efficiency of the stat information cache */
+  fprintf (f, "stat validations: %lu served from memory, %lu io_stat RPCs "
+	   "(%lu in the background)\n", node_stat_hits, node_stat_rpcs,
+	   node_stat_refreshes);
+
+  /*Report the state of the port pool */
+  fprintf (f, "port pool: %lu of %d nodes, %lu ports given up, "
+	   "%lu reopened\n", node_ports_count, node_ports_max,
+	   node_ports_released, node_ports_reopened);
+
+  /*Report the efficiency of the cached listings */
+  fprintf (f, "directory listings: %lu served from memory, %lu read\n",
+	   node_listing_hits, node_listing_reads);
+
+  /*Report the efficiency of the negative lookup entries */
+  fprintf (f, "negative lookups: %lu hits, %lu misses\n",
+	   lnode_negative_hits, lnode_negative_misses);
+
+  /*Report the memory occupied by the caches */
+  memory_report (f);
+}				/*stats_report */
+
+/*---------------------------------------------------------------------------*/
+/*Writes the report of all statistics counters into the file `path`
+  (which is truncated)*/
+error_t stats_dump (const char * path)
+{
+  /*Open the file to write the report to */
+  FILE *f = fopen (path, "w");
+  if (!f)
+    return errno;
+
+  /*Write the report */
+  stats_report (f);
+
+  /*Close the file and return the result */
+  return (fclose (f) == 0) ? (0) : (errno);
+}				/*stats_dump */
+
+/*---------------------------------------------------------------------------*/
@@ -0,0 +1,40 @@
+/*---------------------------------------------------------------------------*/
+/*stats.h*/
+/*---------------------------------------------------------------------------*/
+/*Declarations of the functions reporting the internal statistics.*/
+/*---------------------------------------------------------------------------*/
+/*Copyright (C) 2009 Free Software Foundation, Inc.
+
+  This program is free software; you can redistribute it and/or
+  modify it under the terms of the GNU General Public License as
+  published by the Free Software Foundation; either version 2 of the
+  License, or * (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+  General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307
+  USA.*/
+/*---------------------------------------------------------------------------*/
+#ifndef __STATS_H__
+#define __STATS_H__
+
+/*---------------------------------------------------------------------------*/
+#include <stdio.h>
+#include <error.h>
+/*---------------------------------------------------------------------------*/
+
+/*---------------------------------------------------------------------------*/
+/*--------Functions----------------------------------------------------------*/
+/*Prints the current values of all statistics counters to `f`*/
+void stats_report (FILE * f);
+/*---------------------------------------------------------------------------*/
+/*Writes the report of all statistics counters into the file `path`
+  (which is truncated)*/
+error_t stats_dump (const char * path);
+/*---------------------------------------------------------------------------*/
+#endif /*__STATS_H__*/